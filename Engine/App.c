@@ -1,12 +1,112 @@
 #include "App.h"
 #include "util.h"
 
+// stb_image allocates through these, so a decode can be pointed at mapped staging memory, see decode_into_staging
+static void* decode_malloc(size_t size);
+static void* decode_realloc(void *ptr, size_t size);
+static void decode_free(void *ptr);
+#define STBI_MALLOC(size) decode_malloc(size)
+#define STBI_REALLOC(ptr, size) decode_realloc(ptr, size)
+#define STBI_FREE(ptr) decode_free(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "ext/stb_image.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
 state_t state;
+config_t config;
 glyph_uv_t glyphs[128];
 
+double VK_GETTIME(void)
+{
+    // Monotonic clock that also works in headless mode, where GLFW is never initialised
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static const struct
+{
+    const char *name;
+    VkPresentModeKHR mode;
+} present_modes[] = {
+    {"immediate", VK_PRESENT_MODE_IMMEDIATE_KHR},
+    {"mailbox", VK_PRESENT_MODE_MAILBOX_KHR},
+    {"fifo", VK_PRESENT_MODE_FIFO_KHR},
+    {"fifo-relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR},
+};
+#define PRESENT_MODE_COUNT (sizeof(present_modes) / sizeof(present_modes[0]))
+
+static void parse_present_mode(const char *name)
+{
+    for (uint32_t i = 0; i < PRESENT_MODE_COUNT; i++)
+    {
+        if (strcmp(name, present_modes[i].name) == 0)
+        {
+            config.present_mode = present_modes[i].mode;
+            return;
+        }
+    }
+    fprintf(stderr, "Warning: Unknown present mode %s, using immediate\n", name);
+}
+
+static const char* present_mode_name(const VkPresentModeKHR mode)
+{
+    for (uint32_t i = 0; i < PRESENT_MODE_COUNT; i++)
+        if (present_modes[i].mode == mode) return present_modes[i].name;
+    return "unknown";
+}
+
+void VK_ARGS(const int argc, char **argv)
+{
+    profile_main_thread();
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0) config.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) config.max_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) config.max_seconds = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) config.golden_script = argv[++i];
+        else if (strcmp(argv[i], "--golden-dir") == 0 && i + 1 < argc) config.golden_dir = argv[++i];
+        else if (strcmp(argv[i], "--update-golden") == 0) config.golden_update = true;
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) config.report_path = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) config.trace_path = argv[++i];
+        else if (strcmp(argv[i], "--frames-csv") == 0 && i + 1 < argc) config.frames_csv = argv[++i];
+        else if (strcmp(argv[i], "--hitch-ms") == 0 && i + 1 < argc) config.hitch_ms = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) config.record_path = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) config.replay_path = argv[++i];
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) config.capture_path = argv[++i];
+        else if (strcmp(argv[i], "--capture-at") == 0 && i + 1 < argc) config.capture_at = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--capture-frames") == 0 && i + 1 < argc) config.capture_frames = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--lazy-init") == 0) config.lazy_init = true;
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) config.jobs = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc) config.shader_dir = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) config.pack_path = argv[++i];
+        else if (strcmp(argv[i], "--cubes") == 0 && i + 1 < argc) config.cubes = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--no-cull") == 0) config.no_cull = true;
+        else if (strcmp(argv[i], "--parallel-record") == 0) config.parallel_record = true;
+        else if (strcmp(argv[i], "--dynamic-res") == 0 && i + 1 < argc) config.dynamic_res_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) config.render_scale = (float) atof(argv[++i]);
+        else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) parse_present_mode(argv[++i]);
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) config.fps_limit = atof(argv[++i]);
+        else if (strcmp(argv[i], "--no-throttle") == 0) config.no_throttle = true;
+        else if (strcmp(argv[i], "--depth-prepass") == 0) config.depth_prepass = true;
+        else fprintf(stderr, "Warning: Unknown argument %s\n", argv[i]);
+    }
+}
+
+bool VK_KEYDOWN(const int key)
+{
+    if (config.replay_path && !replay_engine_key(key)) return replay_keydown(key);
+    if (config.headless) return false;
+
+    const bool down = glfwGetKey(state.glfw.win, key) == GLFW_PRESS;
+    if (down && config.record_path) replay_key(key);
+    return down;
+}
+
 static uint32_t find_memory_type(const uint32_t type_filter, const VkMemoryPropertyFlags properties)
 {
     VkPhysicalDeviceMemoryProperties mem_properties;
@@ -45,15 +145,15 @@ static void create_buffer(const VkDeviceSize size, const VkBufferUsageFlags usag
     vkBindBufferMemory(state.v.device, *outBuffer, *outMemory, 0);
 }
 
-static void create_image(const uint32_t width, const uint32_t height, const VkFormat format, const VkImageTiling tiling,
-                         const VkImageUsageFlags usage, const VkMemoryPropertyFlags properties, VkImage *outImage,
-                         VkDeviceMemory *outMemory)
+static void create_image(const uint32_t width, const uint32_t height, const uint32_t mip_levels, const VkFormat format,
+                         const VkImageTiling tiling, const VkImageUsageFlags usage, const VkMemoryPropertyFlags properties,
+                         VkImage *outImage, VkDeviceMemory *outMemory)
 {
     const VkImageCreateInfo image_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
         .extent = {width, height, 1},
-        .mipLevels = 1,
+        .mipLevels = mip_levels,
         .arrayLayers = 1,
         .format = format,
         .tiling = tiling,
@@ -77,7 +177,7 @@ static void create_image(const uint32_t width, const uint32_t height, const VkFo
     vkBindImageMemory(state.v.device, *outImage, *outMemory, 0);
 }
 
-static void transition_image_layout(VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout)
+static void transition_image_layout(VkImage image, VkFormat format, uint32_t mip_levels, VkImageLayout old_layout, VkImageLayout new_layout)
 {
     const VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -97,7 +197,7 @@ static void transition_image_layout(VkImage image, VkFormat format, VkImageLayou
         .subresourceRange = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = mip_levels,
             .baseArrayLayer = 0,
             .layerCount = 1
         }
@@ -146,7 +246,8 @@ static void transition_image_layout(VkImage image, VkFormat format, VkImageLayou
     vkResetCommandBuffer(state.v.loadingCommandBuffer, 0);
 }
 
-static void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+// The buffer holds RGBA8 levels back to back, level 0 first, each half the size of the one before
+static void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, const uint32_t mip_levels)
 {
     const VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -154,21 +255,28 @@ static void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width,
     };
 
     vkBeginCommandBuffer(state.v.loadingCommandBuffer, &begin_info);
-    const VkBufferImageCopy region = {
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
-        .imageSubresource = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .mipLevel = 0,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        },
-        .imageOffset = {0, 0, 0},
-        .imageExtent = {width, height, 1}
-    };
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < mip_levels; level++)
+    {
+        const VkBufferImageCopy region = {
+            .bufferOffset = offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            },
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {width, height, 1}
+        };
 
-    vkCmdCopyBufferToImage(state.v.loadingCommandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        vkCmdCopyBufferToImage(state.v.loadingCommandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        offset += (VkDeviceSize) width * height * 4;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
     vkEndCommandBuffer(state.v.loadingCommandBuffer);
     const VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -181,44 +289,96 @@ static void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width,
     vkResetCommandBuffer(state.v.loadingCommandBuffer, 0);
 }
 
-static void create_texture_from_file(const char *path, texture_t *texture)
+static uint32_t mip_level_count(const uint32_t width, const uint32_t height)
 {
-    int tex_width, tex_height, tex_channels;
-    stbi_uc *pixels = stbi_load(path, &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
-
-    ASSERT(pixels, "failed to load texture");
-
-    texture->width = (uint32_t) tex_width;
-    texture->height = (uint32_t) tex_height;
-
-    const VkDeviceSize image_size = (VkDeviceSize) (tex_width * tex_height * 4);
+    uint32_t levels = 1;
+    for (uint32_t size = width > height ? width : height; size > 1; size >>= 1) levels++;
+    return levels;
+}
 
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_memory;
+// Expects every level in TRANSFER_DST with level 0 filled, leaves the whole chain in SHADER_READ_ONLY
+static void generate_mipmaps(VkImage image, const uint32_t width, const uint32_t height, const uint32_t mip_levels)
+{
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
 
-    create_buffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging_buffer,
-                  &staging_memory);
+    vkBeginCommandBuffer(state.v.loadingCommandBuffer, &begin_info);
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
 
-    void *data;
-    vkMapMemory(state.v.device, staging_memory, 0, image_size, 0, &data);
-    memcpy(data, pixels, (size_t)image_size);
-    vkUnmapMemory(state.v.device, staging_memory);
-    stbi_image_free(pixels);
+    int32_t mip_width = (int32_t) width;
+    int32_t mip_height = (int32_t) height;
+    for (uint32_t i = 1; i < mip_levels; i++)
+    {
+        // Previous level becomes the blit source
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(state.v.loadingCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, NULL, 0, NULL, 1, &barrier);
+
+        const int32_t next_width = mip_width > 1 ? mip_width / 2 : 1;
+        const int32_t next_height = mip_height > 1 ? mip_height / 2 : 1;
+        const VkImageBlit blit = {
+            .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, 1},
+            .srcOffsets = {{0, 0, 0}, {mip_width, mip_height, 1}},
+            .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1},
+            .dstOffsets = {{0, 0, 0}, {next_width, next_height, 1}}
+        };
+        vkCmdBlitImage(state.v.loadingCommandBuffer,
+                       image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1, &blit, VK_FILTER_LINEAR);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(state.v.loadingCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 0, NULL, 0, NULL, 1, &barrier);
 
-    create_image(tex_width, tex_height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                 &texture->image, &texture->memory);
+        mip_width = next_width;
+        mip_height = next_height;
+    }
 
-    transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    // Last level was only ever written
+    barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(state.v.loadingCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &barrier);
 
-    copy_buffer_to_image(staging_buffer, texture->image, (uint32_t) tex_width, (uint32_t) tex_height);
-    transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    vkEndCommandBuffer(state.v.loadingCommandBuffer);
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &state.v.loadingCommandBuffer
+    };
 
-    vkDestroyBuffer(state.v.device, staging_buffer, NULL);
-    vkFreeMemory(state.v.device, staging_memory, NULL);
+    vkQueueSubmit(state.v.graphicsQueue, 1, &submit_info, VK_NULL_HANDLE);
+    vkQueueWaitIdle(state.v.graphicsQueue);
+    vkResetCommandBuffer(state.v.loadingCommandBuffer, 0);
+}
 
+// View and sampler for an image whose levels are all in SHADER_READ_ONLY
+static void create_texture_view(texture_t *texture)
+{
     const VkImageViewCreateInfo view_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = texture->image,
@@ -233,30 +393,231 @@ static void create_texture_from_file(const char *path, texture_t *texture)
         .subresourceRange = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = texture->mip_levels,
             .baseArrayLayer = 0,
             .layerCount = 1
         }
     };
 
     VK_ASSERT(vkCreateImageView(state.v.device, &view_info, NULL, &texture->view), "create texture view");
+
+    // Mipmapped textures get trilinear + anisotropic sampling, everything else stays pixel-exact
+    const bool mipmapped = texture->mip_levels > 1;
+    const bool anisotropic = mipmapped && state.v.maxAnisotropy > 1.0f;
     const VkSamplerCreateInfo sampler_info = {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter = VK_FILTER_NEAREST,
-        .minFilter = VK_FILTER_NEAREST,
+        .magFilter = mipmapped ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+        .minFilter = mipmapped ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
         .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
         .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .anisotropyEnable = VK_FALSE,
+        .anisotropyEnable = anisotropic ? VK_TRUE : VK_FALSE,
+        .maxAnisotropy = anisotropic ? state.v.maxAnisotropy : 1.0f,
         .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
         .unnormalizedCoordinates = VK_FALSE,
         .compareEnable = VK_FALSE,
         .compareOp = VK_COMPARE_OP_ALWAYS,
-        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST
+        .mipmapMode = mipmapped ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .minLod = 0.0f,
+        .maxLod = (float) texture->mip_levels
     };
 
     VK_ASSERT(vkCreateSampler(state.v.device, &sampler_info, NULL, &texture->sampler), "create texture sampler");
 }
 
+// Uploads wait for the queue to go idle, so one staging buffer can be reused by every texture
+static void* texture_staging(const VkDeviceSize size)
+{
+    if (size <= state.v.stagingSize) return state.v.stagingMapped;
+
+    if (state.v.stagingBuffer)
+    {
+        vkUnmapMemory(state.v.device, state.v.stagingMemory);
+        vkDestroyBuffer(state.v.device, state.v.stagingBuffer, NULL);
+        vkFreeMemory(state.v.device, state.v.stagingMemory, NULL);
+    }
+
+    create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &state.v.stagingBuffer,
+                  &state.v.stagingMemory);
+    VK_ASSERT(vkMapMemory(state.v.device, state.v.stagingMemory, 0, size, 0, &state.v.stagingMapped), "map staging buffer");
+    state.v.stagingSize = size;
+    return state.v.stagingMapped;
+}
+
+// While a target is set, the first allocation of exactly the decoded image size on this thread is handed
+// the target instead. For 8-bit PNGs that is the output buffer stbi_load returns, other formats may land an
+// intermediate there first, decode_into_staging then copies their final buffer over it.
+static _Thread_local struct
+{
+    void *target;
+    size_t size;
+    bool taken;
+} decode_target;
+
+static void* decode_malloc(const size_t size)
+{
+    if (decode_target.target && !decode_target.taken && size == decode_target.size)
+    {
+        decode_target.taken = true;
+        return decode_target.target;
+    }
+    return malloc(size);
+}
+
+static void* decode_realloc(void *ptr, const size_t size)
+{
+    if (!ptr || ptr != decode_target.target) return realloc(ptr, size);
+
+    void *moved = malloc(size);
+    if (moved) memcpy(moved, ptr, size < decode_target.size ? size : decode_target.size);
+    return moved;
+}
+
+static void decode_free(void *ptr)
+{
+    if (ptr && ptr == decode_target.target) return;
+    free(ptr);
+}
+
+// RGBA8 straight into the staging buffer, without a second full-size copy on the heap
+static void decode_into_staging(const char *path, int *width, int *height)
+{
+    int channels;
+    ASSERT(stbi_info(path, width, height, &channels), "failed to load texture");
+
+    const size_t image_size = (size_t) *width * *height * 4;
+    decode_target.target = texture_staging(image_size);
+    decode_target.size = image_size;
+    decode_target.taken = false;
+
+    int decoded_width, decoded_height;
+    stbi_uc *pixels = stbi_load(path, &decoded_width, &decoded_height, &channels, STBI_rgb_alpha);
+    void *staging = decode_target.target;
+    decode_target.target = NULL;
+
+    ASSERT(pixels && decoded_width == *width && decoded_height == *height, "failed to load texture");
+    if (pixels != staging)
+    {
+        memcpy(staging, pixels, image_size);
+        stbi_image_free(pixels);
+    }
+}
+
+static const pack_entry_t* packed_texture(const char *path)
+{
+    const pack_entry_t *entry = pack_find(path);
+    return entry && entry->type == PACK_TEXTURE && entry->format == VK_FORMAT_R8G8B8A8_SRGB ? entry : NULL;
+}
+
+// Pre-decoded RGBA8 straight from the mapped pack into staging, mips included, so nothing is decoded or
+// blitted. Textures loaded without TEXTURE_MIPMAPPED only upload level 0.
+static bool create_texture_from_pack(const char *path, const texture_flags_t flags, texture_t *texture)
+{
+    const pack_entry_t *entry = packed_texture(path);
+    if (!entry) return false;
+
+    texture->width = entry->width;
+    texture->height = entry->height;
+    texture->mip_levels = (flags & TEXTURE_MIPMAPPED) ? entry->mip_levels : 1;
+
+    VkDeviceSize upload_size = 0;
+    for (uint32_t level = 0, w = texture->width, h = texture->height; level < texture->mip_levels; level++)
+    {
+        upload_size += (VkDeviceSize) w * h * 4;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    if (upload_size > entry->size)
+    {
+        fprintf(stderr, "Warning: Packed texture %s is smaller than its mip chain, loading the file instead\n", path);
+        return false;
+    }
+
+    memcpy(texture_staging(upload_size), pack_data(entry), (size_t) upload_size);
+
+    create_image(texture->width, texture->height, texture->mip_levels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 &texture->image, &texture->memory);
+
+    VkMemoryRequirements mem_reqs;
+    vkGetImageMemoryRequirements(state.v.device, texture->image, &mem_reqs);
+    texture->size = mem_reqs.size;
+
+    transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, texture->mip_levels,
+                            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    copy_buffer_to_image(state.v.stagingBuffer, texture->image, texture->width, texture->height, texture->mip_levels);
+    transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, texture->mip_levels,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    create_texture_view(texture);
+    return true;
+}
+
+// Expects level 0 as RGBA8 at the start of the staging buffer, the path is only used for messages
+static void create_texture_from_staging(const char *path, const texture_flags_t flags, const int tex_width,
+                                        const int tex_height, texture_t *texture)
+{
+    texture->width = (uint32_t) tex_width;
+    texture->height = (uint32_t) tex_height;
+    texture->mip_levels = 1;
+
+    // Blitting down the chain needs the format as blit source and destination, with linear filtering
+    if (flags & TEXTURE_MIPMAPPED)
+    {
+        const VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                                   VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(state.v.physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &properties);
+        if ((properties.optimalTilingFeatures & blit_features) == blit_features)
+            texture->mip_levels = mip_level_count(texture->width, texture->height);
+        else
+            fprintf(stderr, "Warning: no linear blit support, %s loaded without mipmaps\n", path);
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (texture->mip_levels > 1) usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+    create_image(tex_width, tex_height, texture->mip_levels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+                 usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture->image, &texture->memory);
+
+    VkMemoryRequirements mem_reqs;
+    vkGetImageMemoryRequirements(state.v.device, texture->image, &mem_reqs);
+    texture->size = mem_reqs.size;
+
+    transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, texture->mip_levels,
+                            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    copy_buffer_to_image(state.v.stagingBuffer, texture->image, (uint32_t) tex_width, (uint32_t) tex_height, 1);
+    if (texture->mip_levels > 1)
+        generate_mipmaps(texture->image, texture->width, texture->height, texture->mip_levels);
+    else
+        transition_image_layout(texture->image, VK_FORMAT_R8G8B8A8_SRGB, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    create_texture_view(texture);
+}
+
+// Takes ownership of pixels (RGBA8 from stbi_load), for images decoded before the device existed
+static void create_texture_from_pixels(const char *path, const texture_flags_t flags, stbi_uc *pixels,
+                                       const int tex_width, const int tex_height, texture_t *texture)
+{
+    ASSERT(pixels, "failed to load texture");
+
+    const size_t image_size = (size_t) tex_width * tex_height * 4;
+    memcpy(texture_staging(image_size), pixels, image_size);
+    stbi_image_free(pixels);
+    create_texture_from_staging(path, flags, tex_width, tex_height, texture);
+}
+
+static void create_texture_from_file(const char *path, const texture_flags_t flags, texture_t *texture)
+{
+    if (create_texture_from_pack(path, flags, texture)) return;
+
+    int tex_width, tex_height;
+    decode_into_staging(path, &tex_width, &tex_height);
+    create_texture_from_staging(path, flags, tex_width, tex_height, texture);
+}
+
 static void create_descriptor_set_layout(void)
 {
     const VkDescriptorSetLayoutBinding bindings[] = {
@@ -278,32 +639,46 @@ static void create_descriptor_set_layout(void)
     VK_ASSERT(vkCreateDescriptorSetLayout(state.v.device, &layout_info, NULL, &state.v.textureSetLayout), "create descriptor set layout");
 }
 
-static void create_descriptor_pool(void)
+// Pools are chained, a new one is added whenever the newest runs out
+static VkDescriptorPool create_descriptor_pool(void)
 {
     const VkDescriptorPoolSize pool_sizes[] = {
         {
             .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = MAX_TEXTURES
+            .descriptorCount = DESCRIPTOR_POOL_SETS
         }
     };
     const VkDescriptorPoolCreateInfo pool_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets = MAX_TEXTURES,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .maxSets = DESCRIPTOR_POOL_SETS,
         .poolSizeCount = 1,
         .pPoolSizes = pool_sizes
     };
-    VK_ASSERT(vkCreateDescriptorPool(state.v.device, &pool_info, NULL, &state.v.descriptorPool), "create descriptor pool");
+
+    state.v.descriptorPools = realloc(state.v.descriptorPools, sizeof(VkDescriptorPool) * (state.v.descriptorPoolCount + 1));
+    ASSERT(state.v.descriptorPools, "failed to grow descriptor pool list");
+    VkDescriptorPool *pool = &state.v.descriptorPools[state.v.descriptorPoolCount++];
+    VK_ASSERT(vkCreateDescriptorPool(state.v.device, &pool_info, NULL, pool), "create descriptor pool");
+    return *pool;
 }
 
-static void create_descriptor_set(texture_t *texture, VkDescriptorSet *descriptor_set)
+static VkDescriptorPool create_descriptor_set(texture_t *texture, VkDescriptorSet *descriptor_set)
 {
-    const VkDescriptorSetAllocateInfo alloc_info = {
+    VkDescriptorSetAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = state.v.descriptorPool,
+        .descriptorPool = state.v.descriptorPools[state.v.descriptorPoolCount - 1],
         .descriptorSetCount = 1,
         .pSetLayouts = &state.v.textureSetLayout
     };
-    VK_ASSERT(vkAllocateDescriptorSets(state.v.device, &alloc_info, descriptor_set), "allocate descriptor set");
+
+    VkResult result = vkAllocateDescriptorSets(state.v.device, &alloc_info, descriptor_set);
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+    {
+        alloc_info.descriptorPool = create_descriptor_pool();
+        result = vkAllocateDescriptorSets(state.v.device, &alloc_info, descriptor_set);
+    }
+    VK_ASSERT(result, "allocate descriptor set");
 
     const VkDescriptorImageInfo image_info = {
         .sampler = texture->sampler,
@@ -321,6 +696,162 @@ static void create_descriptor_set(texture_t *texture, VkDescriptorSet *descripto
         .pImageInfo = &image_info
     };
 
+    vkUpdateDescriptorSets(state.v.device, 1, &write, 0, NULL);
+    return alloc_info.descriptorPool;
+}
+
+// One update-after-bind set holding every resident texture, indexed per vertex by the level shader
+static void create_bindless_resources(void)
+{
+    const VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                                   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+    const VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindingFlags = &binding_flags
+    };
+
+    const VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = state.v.bindlessCapacity,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+    };
+
+    const VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flags_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 1,
+        .pBindings = &binding
+    };
+    VK_ASSERT(vkCreateDescriptorSetLayout(state.v.device, &layout_info, NULL, &state.v.bindlessSetLayout), "create bindless set layout");
+
+    const VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = state.v.bindlessCapacity
+    };
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size
+    };
+    VK_ASSERT(vkCreateDescriptorPool(state.v.device, &pool_info, NULL, &state.v.bindlessPool), "create bindless pool");
+
+    const VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = state.v.bindlessPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &state.v.bindlessSetLayout
+    };
+    VK_ASSERT(vkAllocateDescriptorSets(state.v.device, &alloc_info, &state.v.bindlessSet), "allocate bindless set");
+
+    // Handed out lowest first
+    state.v.bindless_free_slots = malloc(sizeof(uint32_t) * state.v.bindlessCapacity);
+    ASSERT(state.v.bindless_free_slots, "failed to allocate bindless slot list");
+    for (uint32_t i = 0; i < state.v.bindlessCapacity; i++)
+        state.v.bindless_free_slots[i] = state.v.bindlessCapacity - 1 - i;
+    state.v.bindless_free_count = state.v.bindlessCapacity;
+}
+
+// Set 0 of every graphics pipeline. The camera is a plain uniform buffer, the draw uniforms are one
+// dynamic uniform buffer the draws index into, so the set is written once and only the offset changes.
+static void create_frame_resources(void)
+{
+    const VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+        }
+    };
+
+    const VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings
+    };
+    VK_ASSERT(vkCreateDescriptorSetLayout(state.v.device, &layout_info, NULL, &state.v.frameSetLayout), "create frame set layout");
+
+    const VkDescriptorPoolSize pool_sizes[] = {
+        {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1},
+        {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1}
+    };
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes
+    };
+    VK_ASSERT(vkCreateDescriptorPool(state.v.device, &pool_info, NULL, &state.v.framePool), "create frame descriptor pool");
+
+    const VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = state.v.framePool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &state.v.frameSetLayout
+    };
+    VK_ASSERT(vkAllocateDescriptorSets(state.v.device, &alloc_info, &state.v.frameSet), "allocate frame descriptor set");
+
+    // The alignment is a power of two
+    const VkDeviceSize alignment = state.v.deviceProperties.limits.minUniformBufferOffsetAlignment;
+    state.v.draw_uniform_stride = (uint32_t) ((sizeof(draw_uniforms_t) + alignment - 1) & ~(alignment - 1));
+
+    create_buffer(sizeof(camera_uniforms_t), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &state.v.cameraBuffer, &state.v.cameraMemory);
+    VK_ASSERT(vkMapMemory(state.v.device, state.v.cameraMemory, 0, VK_WHOLE_SIZE, 0, (void **) &state.v.camera),
+              "map camera buffer");
+    create_buffer((VkDeviceSize) state.v.draw_uniform_stride * MAX_DRAW_UNIFORMS, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &state.v.drawUniformBuffer, &state.v.drawUniformMemory);
+    VK_ASSERT(vkMapMemory(state.v.device, state.v.drawUniformMemory, 0, VK_WHOLE_SIZE, 0, (void **) &state.v.draw_uniforms),
+              "map draw uniform buffer");
+
+    const VkDescriptorBufferInfo buffer_infos[] = {
+        {.buffer = state.v.cameraBuffer, .offset = 0, .range = sizeof(camera_uniforms_t)},
+        {.buffer = state.v.drawUniformBuffer, .offset = 0, .range = sizeof(draw_uniforms_t)}
+    };
+    VkWriteDescriptorSet writes[2];
+    for (uint32_t i = 0; i < 2; i++)
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = state.v.frameSet,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = bindings[i].descriptorType,
+            .pBufferInfo = &buffer_infos[i]
+        };
+    vkUpdateDescriptorSets(state.v.device, 2, writes, 0, NULL);
+}
+
+static void write_bindless_texture(const texture_t *texture, const uint32_t slot)
+{
+    const VkDescriptorImageInfo image_info = {
+        .sampler = texture->sampler,
+        .imageView = texture->view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = state.v.bindlessSet,
+        .dstBinding = 0,
+        .dstArrayElement = slot,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &image_info
+    };
+
     vkUpdateDescriptorSets(state.v.device, 1, &write, 0, NULL);
 }
 
@@ -337,32 +868,267 @@ static void read_file(const char *path, char **data, size_t *size)
     fclose(file);
 }
 
-VkDescriptorSet* vk_get_texture(const char* path)
+// SPIR-V comes from the copy compiled into the library, --shader-dir (or a build without
+// glslangValidator) reads the .spv files from disk or the resource pack instead
+typedef struct
 {
-    if (!path) return NULL;
+    const char *name; // file name under SHADER_DIR, e.g. "tex.vert.spv"
+    const char *code;
+    size_t size;
+    bool owned;       // read from disk, free once the pipeline exists
+} shader_file_t;
 
-    for (uint32_t i = 0; i < state.v.texture_count; i++) {
-        if (strcmp(state.v.texture_cache[i].path, path) == 0) {
-            return &state.v.texture_cache[i].descriptor_set;
-        }
-    }
+static bool load_embedded_shader(shader_file_t *shader)
+{
+    const uint32_t *embedded = config.shader_dir ? NULL : shader_lookup(shader->name, &shader->size);
+    shader->code = (const char *) embedded;
+    shader->owned = false;
+    return embedded != NULL;
+}
 
-    if (state.v.texture_count >= MAX_TEXTURES) {
-        fprintf(stderr, "Warning: Texture cache full, cannot load %s\n", path);
-        return NULL;
-    }
+static bool load_packed_shader(shader_file_t *shader, const char *path)
+{
+    const pack_entry_t *entry = config.shader_dir ? NULL : pack_find(path);
+    if (!entry || entry->type != PACK_FILE) return false;
+    shader->code = pack_data(entry);
+    shader->size = (size_t) entry->size;
+    shader->owned = false;
+    return true;
+}
 
-    texture_cache_entry_t *entry = &state.v.texture_cache[state.v.texture_count];
-    strncpy(entry->path, path, sizeof(entry->path) - 1);
+static void load_shader(shader_file_t *shader)
+{
+    if (load_embedded_shader(shader)) return;
 
-    create_texture_from_file(path, &entry->texture);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", config.shader_dir ? config.shader_dir : SHADER_DIR, shader->name);
+    if (load_packed_shader(shader, path)) return;
 
-    create_descriptor_set(&entry->texture, &entry->descriptor_set);
+    char *data;
+    read_file(path, &data, &shader->size);
+    shader->code = data;
+    shader->owned = true;
+}
 
-    entry->loaded = true;
-    state.v.texture_count++;
+static void free_shader(shader_file_t *shader)
+{
+    if (shader->owned) free((void *) shader->code);
+    shader->code = NULL;
+    shader->owned = false;
+}
+
+static uint32_t texture_hash(const char *path, const texture_flags_t flags)
+{
+    // FNV-1a, flags folded in so the same file can be registered with different sampling
+    uint32_t hash = 2166136261u ^ (uint32_t) flags;
+    for (const char *p = path; *p; p++)
+    {
+        hash ^= (uint8_t) *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void texture_lookup_insert(const texture_handle_t handle)
+{
+    const uint32_t mask = state.v.texture_lookup_capacity - 1;
+    uint32_t slot = state.v.textures[handle - 1].hash & mask;
+    while (state.v.texture_lookup[slot]) slot = (slot + 1) & mask;
+    state.v.texture_lookup[slot] = handle;
+}
+
+static void texture_lookup_grow(void)
+{
+    free(state.v.texture_lookup);
+    state.v.texture_lookup_capacity = state.v.texture_lookup_capacity ? state.v.texture_lookup_capacity * 2 : TEXTURE_LOOKUP_MIN;
+    state.v.texture_lookup = calloc(state.v.texture_lookup_capacity, sizeof(texture_handle_t));
+    ASSERT(state.v.texture_lookup, "failed to grow texture lookup");
+
+    for (texture_handle_t handle = 1; handle <= state.v.texture_count; handle++)
+        texture_lookup_insert(handle);
+}
+
+// Returns the texture's GPU objects to the retire queue, they are destroyed once no frame in flight can use them
+static void texture_evict(texture_entry_t *entry)
+{
+    if (state.v.texture_retired_count == state.v.texture_retired_capacity)
+    {
+        state.v.texture_retired_capacity = state.v.texture_retired_capacity ? state.v.texture_retired_capacity * 2 : 16;
+        state.v.texture_retired = realloc(state.v.texture_retired, sizeof(texture_retired_t) * state.v.texture_retired_capacity);
+        ASSERT(state.v.texture_retired, "failed to grow texture retire queue");
+    }
+
+    state.v.texture_retired[state.v.texture_retired_count++] = (texture_retired_t){
+        .texture = entry->texture,
+        .descriptor_set = entry->descriptor_set,
+        .descriptor_pool = entry->descriptor_pool,
+        .material = entry->material,
+        .retire_frame = state.v.frameIndex
+    };
+
+    state.v.texture_resident_bytes -= entry->texture.size;
+    entry->resident = false;
+}
+
+static void texture_destroy_retired(const bool all)
+{
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < state.v.texture_retired_count; i++)
+    {
+        texture_retired_t *retired = &state.v.texture_retired[i];
+        if (!all && retired->retire_frame + MAX_FRAMES_IN_FLIGHT > state.v.frameIndex)
+        {
+            state.v.texture_retired[kept++] = *retired;
+            continue;
+        }
+
+        vkFreeDescriptorSets(state.v.device, retired->descriptor_pool, 1, &retired->descriptor_set);
+        vkDestroySampler(state.v.device, retired->texture.sampler, NULL);
+        vkDestroyImageView(state.v.device, retired->texture.view, NULL);
+        vkDestroyImage(state.v.device, retired->texture.image, NULL);
+        vkFreeMemory(state.v.device, retired->texture.memory, NULL);
+        if (state.v.bindless) state.v.bindless_free_slots[state.v.bindless_free_count++] = retired->material;
+    }
+    state.v.texture_retired_count = kept;
+}
 
-    return &entry->descriptor_set;
+// Least recently used texture that was not touched this frame, NULL if everything resident is in use
+static texture_entry_t* texture_lru(void)
+{
+    texture_entry_t *oldest = NULL;
+    for (uint32_t i = 0; i < state.v.texture_count; i++)
+    {
+        texture_entry_t *entry = &state.v.textures[i];
+        if (!entry->resident || entry->last_used_frame >= state.v.frameIndex) continue;
+        if (!oldest || entry->last_used_frame < oldest->last_used_frame) oldest = entry;
+    }
+    return oldest;
+}
+
+// What a texture will take once loaded, read from the pack entry or the image header, a full mip chain
+// adds about a third
+static VkDeviceSize texture_size_estimate(const char *path, const texture_flags_t flags)
+{
+    VkDeviceSize width = 0, height = 0;
+    const pack_entry_t *entry = packed_texture(path);
+    int w, h, channels;
+    if (entry)
+    {
+        width = entry->width;
+        height = entry->height;
+    }
+    else if (stbi_info(path, &w, &h, &channels))
+    {
+        width = (VkDeviceSize) w;
+        height = (VkDeviceSize) h;
+    }
+
+    const VkDeviceSize size = width * height * 4;
+    return (flags & TEXTURE_MIPMAPPED) ? size + size / 3 : size;
+}
+
+// False when no bindless slot is free this frame, the texture is then skipped until the next one
+static bool texture_make_resident(texture_entry_t *entry)
+{
+    // Slots only come back at a frame boundary, once their texture is destroyed. Evict for the next frame
+    // rather than wait for the queue to go idle in the middle of recording.
+    if (state.v.bindless && !state.v.bindless_free_count)
+    {
+        static bool warned;
+        texture_entry_t *victim = state.v.texture_retired_count ? NULL : texture_lru();
+        if (victim) texture_evict(victim);
+        else if (!state.v.texture_retired_count && !warned)
+        {
+            fprintf(stderr, "Warning: Bindless texture slots exhausted, every resident texture is in use\n");
+            warned = true;
+        }
+        return false;
+    }
+
+    // Room is made before loading, so the budget holds at the peak too
+    const VkDeviceSize estimate = texture_size_estimate(entry->path, entry->flags);
+    while (state.v.texture_resident_bytes + estimate > TEXTURE_VRAM_BUDGET)
+    {
+        texture_entry_t *victim = texture_lru();
+        if (!victim)
+        {
+            fprintf(stderr, "Warning: Texture budget exceeded, every resident texture is in use\n");
+            break;
+        }
+        texture_evict(victim);
+    }
+
+    create_texture_from_file(entry->path, entry->flags, &entry->texture);
+    if (state.v.bindless)
+    {
+        entry->material = state.v.bindless_free_slots[--state.v.bindless_free_count];
+        write_bindless_texture(&entry->texture, entry->material);
+    }
+
+    entry->descriptor_pool = create_descriptor_set(&entry->texture, &entry->descriptor_set);
+    state.v.texture_resident_bytes += entry->texture.size;
+    entry->resident = true;
+    return true;
+}
+
+texture_handle_t vk_texture_handle(const char* path, const texture_flags_t flags)
+{
+    if (!path) return 0;
+
+    const uint32_t hash = texture_hash(path, flags);
+    if (state.v.texture_lookup_capacity)
+    {
+        const uint32_t mask = state.v.texture_lookup_capacity - 1;
+        for (uint32_t slot = hash & mask; state.v.texture_lookup[slot]; slot = (slot + 1) & mask)
+        {
+            const texture_entry_t *entry = &state.v.textures[state.v.texture_lookup[slot] - 1];
+            if (entry->hash == hash && entry->flags == flags && strcmp(entry->path, path) == 0)
+                return state.v.texture_lookup[slot];
+        }
+    }
+
+    // Keep the lookup at most 3/4 full
+    if ((state.v.texture_count + 1) * 4 > state.v.texture_lookup_capacity * 3) texture_lookup_grow();
+
+    if (state.v.texture_count == state.v.texture_capacity)
+    {
+        state.v.texture_capacity = state.v.texture_capacity ? state.v.texture_capacity * 2 : 16;
+        state.v.textures = realloc(state.v.textures, sizeof(texture_entry_t) * state.v.texture_capacity);
+        ASSERT(state.v.textures, "failed to grow texture registry");
+    }
+
+    state.v.textures[state.v.texture_count++] = (texture_entry_t){
+        .path = strdup(path),
+        .flags = flags,
+        .hash = hash
+    };
+
+    const texture_handle_t handle = state.v.texture_count;
+    texture_lookup_insert(handle);
+    return handle;
+}
+
+static texture_entry_t* texture_use(const texture_handle_t handle)
+{
+    if (!handle || handle > state.v.texture_count) return NULL;
+
+    texture_entry_t *entry = &state.v.textures[handle - 1];
+    if (!entry->resident && !texture_make_resident(entry)) return NULL;
+    entry->last_used_frame = state.v.frameIndex;
+    return entry;
+}
+
+VkDescriptorSet vk_texture_bind(const texture_handle_t handle, uint32_t *material)
+{
+    const texture_entry_t *entry = texture_use(handle);
+    if (material) *material = entry ? entry->material : 0;
+    return entry ? entry->descriptor_set : VK_NULL_HANDLE;
+}
+
+uint32_t vk_texture_material(const texture_handle_t handle)
+{
+    const texture_entry_t *entry = texture_use(handle);
+    return entry ? entry->material : 0;
 }
 
 static VkFormat _find_depth_format(void)
@@ -437,7 +1203,7 @@ static void create_depth_resources(void)
     VK_ASSERT(vkCreateImageView(state.v.device, &view_info, NULL, &state.v.depthImageView), "create depth image view");
 
     // Transition layout
-    transition_image_layout(state.v.depthImage, depth_format,
+    transition_image_layout(state.v.depthImage, depth_format, 1,
         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 }
 
@@ -454,19 +1220,21 @@ static VkShaderModule create_shader_module(const char *code, const size_t size)
     return shader_module;
 }
 
-static void create_render_pass(void)
+// The scene and HUD passes differ only in what happens to the colour attachment around them, which
+// keeps them compatible, so every pipeline works in both
+static void create_render_pass(const VkAttachmentLoadOp color_load, const VkImageLayout color_initial,
+                               const VkImageLayout color_final, VkRenderPass *render_pass)
 {
     const VkAttachmentDescription attachments[] = {
-        // Color attachment (existing)
         {
             .format = state.v.swapChainImageFormat,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .loadOp = color_load,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+            .initialLayout = color_initial,
+            .finalLayout = color_final
         },
         {
             .format = _find_depth_format(),
@@ -516,16 +1284,146 @@ static void create_render_pass(void)
         .pDependencies = &dependency
     };
 
-    VK_ASSERT(vkCreateRenderPass(state.v.device, &render_pass_info, NULL, &state.v.renderPass), "create render pass");
+    VK_ASSERT(vkCreateRenderPass(state.v.device, &render_pass_info, NULL, render_pass), "create render pass");
 }
 
-static void create_pipeline(const char *vert_path, const char *frag_path, bool textured, pipeline_t *pipeline)
+// The scene target is allocated at full size once, a lower render scale only shrinks the render area
+// and the blit's source rectangle, so resizing never recreates anything
+static void create_scene_target(void)
 {
-    char *vert_code; size_t vert_size;
-    char *frag_code; size_t frag_size;
+    create_image(state.v.swapChainExtent.width, state.v.swapChainExtent.height, 1, state.v.swapChainImageFormat,
+                 VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state.v.sceneImage, &state.v.sceneMemory);
 
-    read_file(vert_path, &vert_code, &vert_size);
-    read_file(frag_path, &frag_code, &frag_size);
+    const VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = state.v.sceneImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = state.v.swapChainImageFormat,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+    VK_ASSERT(vkCreateImageView(state.v.device, &view_info, NULL, &state.v.sceneImageView), "create scene image view");
+
+    const VkImageView attachments[] = {
+        state.v.sceneImageView,
+        state.v.depthImageView
+    };
+
+    const VkFramebufferCreateInfo framebuffer_info = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = state.v.renderPass,
+        .attachmentCount = 2,
+        .pAttachments = attachments,
+        .width = state.v.swapChainExtent.width,
+        .height = state.v.swapChainExtent.height,
+        .layers = 1
+    };
+    VK_ASSERT(vkCreateFramebuffer(state.v.device, &framebuffer_info, NULL, &state.v.sceneFramebuffer), "create scene framebuffer");
+}
+
+// Prefix written in front of the driver blob, a cache from another device or driver build is discarded
+typedef struct
+{
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t  uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+} pipeline_cache_header_t;
+
+#define PIPELINE_CACHE_MAGIC 0x43504b56u // "VKPC"
+
+static void create_pipeline_cache(void)
+{
+    const VkPhysicalDeviceProperties *properties = &state.v.deviceProperties;
+    char *data = NULL;
+    size_t size = 0;
+
+    // Anything wrong with the file only costs a rebuild, the data size is checked against what is on disk
+    FILE *file = fopen(PIPELINE_CACHE_PATH, "rb");
+    if (file)
+    {
+        long file_size = -1;
+        if (fseek(file, 0, SEEK_END) == 0) file_size = ftell(file);
+        rewind(file);
+
+        pipeline_cache_header_t header;
+        const bool header_read = file_size >= (long) sizeof(header) && fread(&header, sizeof(header), 1, file) == 1;
+        if (!header_read || header.magic != PIPELINE_CACHE_MAGIC)
+            fprintf(stderr, "Warning: Pipeline cache %s is truncated or corrupt, rebuilding\n", PIPELINE_CACHE_PATH);
+        else if (header.vendor_id != properties->vendorID || header.device_id != properties->deviceID ||
+                 header.driver_version != properties->driverVersion ||
+                 memcmp(header.uuid, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0)
+            fprintf(stderr, "Warning: Pipeline cache %s is for another device or driver, rebuilding\n", PIPELINE_CACHE_PATH);
+        else if (header.data_size != (uint64_t) (file_size - (long) sizeof(header)))
+            fprintf(stderr, "Warning: Pipeline cache %s is truncated or corrupt, rebuilding\n", PIPELINE_CACHE_PATH);
+        else if (header.data_size)
+        {
+            data = malloc((size_t) header.data_size);
+            if (data && fread(data, 1, (size_t) header.data_size, file) == header.data_size) size = (size_t) header.data_size;
+            else fprintf(stderr, "Warning: Could not read pipeline cache %s, rebuilding\n", PIPELINE_CACHE_PATH);
+        }
+        fclose(file);
+    }
+
+    const VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = size,
+        .pInitialData = size ? data : NULL
+    };
+
+    VK_ASSERT(vkCreatePipelineCache(state.v.device, &cache_info, NULL, &state.v.pipelineCache), "create pipeline cache");
+    state.v.pipelineCacheWarm = size > 0;
+    free(data);
+}
+
+static void save_pipeline_cache(void)
+{
+    size_t size = 0;
+    VK_ASSERT(vkGetPipelineCacheData(state.v.device, state.v.pipelineCache, &size, NULL), "query pipeline cache size");
+    char *data = malloc(size);
+    ASSERT(data, "failed to allocate pipeline cache data");
+    VK_ASSERT(vkGetPipelineCacheData(state.v.device, state.v.pipelineCache, &size, data), "read pipeline cache");
+
+    const VkPhysicalDeviceProperties *properties = &state.v.deviceProperties;
+    pipeline_cache_header_t header = {
+        .magic = PIPELINE_CACHE_MAGIC,
+        .vendor_id = properties->vendorID,
+        .device_id = properties->deviceID,
+        .driver_version = properties->driverVersion,
+        .data_size = size
+    };
+    memcpy(header.uuid, properties->pipelineCacheUUID, VK_UUID_SIZE);
+
+    FILE *file = fopen(PIPELINE_CACHE_PATH, "wb");
+    if (file)
+    {
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(data, 1, size, file);
+        fclose(file);
+    }
+    else fprintf(stderr, "Warning: Could not write pipeline cache %s\n", PIPELINE_CACHE_PATH);
+
+    free(data);
+    vkDestroyPipelineCache(state.v.device, state.v.pipelineCache, NULL);
+}
+
+// Only touches the device and the internally synchronised pipeline cache, so startup runs it on workers.
+// Returns the time vkCreateGraphicsPipelines took, the name is only used for messages.
+// Instanced pipelines read a cube_instance_t per instance from binding 1, at locations 4 to 7
+static double create_pipeline_from_code(const char *name, const char *vert_code, const size_t vert_size,
+                                        const char *frag_code, const size_t frag_size,
+                                        const VkDescriptorSetLayout set_layout, const bool instanced,
+                                        const bool opaque, pipeline_t *pipeline)
+{
+    const bool textured = set_layout != VK_NULL_HANDLE;
 
     const VkShaderModule vert_shader = create_shader_module(vert_code, vert_size);
     const VkShaderModule frag_shader = create_shader_module(frag_code, frag_size);
@@ -543,10 +1441,17 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
         }
     };
 
-    const VkVertexInputBindingDescription binding_description = {
-        .binding = 0,
-        .stride = sizeof(vertex_t),
-        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+    const VkVertexInputBindingDescription binding_descriptions[] = {
+        {
+            .binding = 0,
+            .stride = sizeof(vertex_t),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        },
+        {
+            .binding = 1,
+            .stride = sizeof(cube_instance_t),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        }
     };
 
     const VkVertexInputAttributeDescription attribute_descriptions[] = {
@@ -567,14 +1472,44 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
             .binding = 0,
             .format = VK_FORMAT_R32G32B32A32_SFLOAT,
             .offset = offsetof(vertex_t, color)
+        },
+        {
+            .location = 3,
+            .binding = 0,
+            .format = VK_FORMAT_R32_UINT,
+            .offset = offsetof(vertex_t, material)
+        },
+        {
+            .location = 4,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(cube_instance_t, position)
+        },
+        {
+            .location = 5,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(cube_instance_t, rotation)
+        },
+        {
+            .location = 6,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(cube_instance_t, scale)
+        },
+        {
+            .location = 7,
+            .binding = 1,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(cube_instance_t, color)
         }
     };
 
     const VkPipelineVertexInputStateCreateInfo vertex_input_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &binding_description,
-        .vertexAttributeDescriptionCount = 3,
+        .vertexBindingDescriptionCount = instanced ? 2 : 1,
+        .pVertexBindingDescriptions = binding_descriptions,
+        .vertexAttributeDescriptionCount = instanced ? 8 : 4,
         .pVertexAttributeDescriptions = attribute_descriptions
     };
 
@@ -584,26 +1519,18 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
         .primitiveRestartEnable = VK_FALSE
     };
 
-    const VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float) state.v.swapChainExtent.width,
-        .height = (float) state.v.swapChainExtent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f
-    };
-
-    const VkRect2D scissor = {
-        .offset = {0, 0},
-        .extent = state.v.swapChainExtent
-    };
-
+    // Set per render pass with set_viewport, the scene's size changes with the render scale
     const VkPipelineViewportStateCreateInfo viewport_state = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
-        .pViewports = &viewport,
-        .scissorCount = 1,
-        .pScissors = &scissor
+        .scissorCount = 1
+    };
+
+    const VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    const VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dynamic_states
     };
 
     const VkPipelineRasterizationStateCreateInfo rasterizer = {
@@ -644,16 +1571,12 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
         .blendConstants = {0.0f, 0.0f, 0.0f, 0.0f}
     };
 
-    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+    // Set 0 is the same in every layout, so it stays bound across pipeline switches
+    const VkDescriptorSetLayout set_layouts[] = {state.v.frameSetLayout, set_layout};
+    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = textured ? 1 : 0,
-        .pSetLayouts = textured ? &state.v.textureSetLayout : NULL,
-        .pushConstantRangeCount = 1,
-        .pPushConstantRanges = &(VkPushConstantRange){
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-            .offset = 0,
-            .size = sizeof(push_constants_textured_t)
-        }
+        .setLayoutCount = textured ? 2 : 1,
+        .pSetLayouts = set_layouts
     };
 
     const VkPipelineDepthStencilStateCreateInfo depth_stencil = {
@@ -667,7 +1590,7 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
 
     VK_ASSERT(vkCreatePipelineLayout(state.v.device, &pipeline_layout_info, NULL, &pipeline->layout), "create pipeline layout");
 
-    const VkGraphicsPipelineCreateInfo pipeline_info = {
+    VkGraphicsPipelineCreateInfo pipeline_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .stageCount = 2,
         .pStages = shader_stages,
@@ -678,7 +1601,7 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
         .pMultisampleState = &multisampling,
         .pDepthStencilState = &depth_stencil,
         .pColorBlendState = &color_blending,
-        .pDynamicState = NULL,
+        .pDynamicState = &dynamic_state,
         .layout = pipeline->layout,
         .renderPass = state.v.renderPass,
         .subpass = 0,
@@ -686,116 +1609,930 @@ static void create_pipeline(const char *vert_path, const char *frag_path, bool t
         .basePipelineIndex = -1
     };
 
-    VK_ASSERT(vkCreateGraphicsPipelines(state.v.device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &pipeline->pipeline), "create graphics pipeline");
+    // Creation feedback (core in 1.3) tells whether the driver actually hit the cache
+    VkPipelineCreationFeedback feedback = {0};
+    const VkPipelineCreationFeedbackCreateInfo feedback_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+        .pPipelineCreationFeedback = &feedback
+    };
+    if (state.v.deviceProperties.apiVersion >= VK_API_VERSION_1_3) pipeline_info.pNext = &feedback_info;
+
+    const double start = VK_GETTIME();
+    VK_ASSERT(vkCreateGraphicsPipelines(state.v.device, state.v.pipelineCache, 1, &pipeline_info, NULL, &pipeline->pipeline), "create graphics pipeline");
+    const double elapsed_ms = (VK_GETTIME() - start) * 1000.0;
+
+    const char *result = "unknown";
+    if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)
+        result = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) ? "hit" : "miss";
+    printf("Pipeline %s: %.2f ms (cache %s)\n", name, elapsed_ms, result);
+
+    // --depth-prepass variants: the pre-pass runs the vertex shader alone and writes nothing but depth, the
+    // colour pass shades only the fragments whose depth it laid down
+    double variants_ms = 0.0;
+    if (opaque && config.depth_prepass)
+    {
+        VkPipelineColorBlendAttachmentState prepass_attachment = color_blend_attachment;
+        prepass_attachment.blendEnable = VK_FALSE;
+        prepass_attachment.colorWriteMask = 0;
+        VkPipelineColorBlendStateCreateInfo prepass_blending = color_blending;
+        prepass_blending.pAttachments = &prepass_attachment;
+
+        VkPipelineDepthStencilStateCreateInfo equal_depth = depth_stencil;
+        equal_depth.depthWriteEnable = VK_FALSE;
+        equal_depth.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+        VkGraphicsPipelineCreateInfo variant_infos[2] = {pipeline_info, pipeline_info};
+        variant_infos[0].pNext = variant_infos[1].pNext = NULL;
+        variant_infos[0].stageCount = 1;
+        variant_infos[0].pColorBlendState = &prepass_blending;
+        variant_infos[1].pDepthStencilState = &equal_depth;
+
+        VkPipeline variants[2];
+        const double variants_start = VK_GETTIME();
+        VK_ASSERT(vkCreateGraphicsPipelines(state.v.device, state.v.pipelineCache, 2, variant_infos, NULL, variants),
+                  "create depth pre-pass pipelines");
+        variants_ms = (VK_GETTIME() - variants_start) * 1000.0;
+        pipeline->prepass = variants[0];
+        pipeline->equal = variants[1];
+    }
+
+    vkDestroyShaderModule(state.v.device, vert_shader, NULL);
+    vkDestroyShaderModule(state.v.device, frag_shader, NULL);
+    return elapsed_ms + variants_ms;
+}
+
+static void create_pipeline(const char *vert_name, const char *frag_name, const VkDescriptorSetLayout set_layout,
+                            const bool instanced, const bool opaque, pipeline_t *pipeline)
+{
+    shader_file_t vert = {.name = vert_name};
+    shader_file_t frag = {.name = frag_name};
+    load_shader(&vert);
+    load_shader(&frag);
+
+    state.v.pipelineCreateMs += create_pipeline_from_code(vert_name, vert.code, vert.size, frag.code, frag.size,
+                                                          set_layout, instanced, opaque, pipeline);
+    free_shader(&vert);
+    free_shader(&frag);
+}
+
+// One descriptor set and push constants, both visible to the compute stage only
+static void create_compute_pipeline(const char *comp_name, const VkDescriptorSetLayout set_layout,
+                                    const uint32_t push_size, pipeline_t *pipeline)
+{
+    shader_file_t comp = {.name = comp_name};
+    load_shader(&comp);
+    const VkShaderModule comp_shader = create_shader_module(comp.code, comp.size);
+
+    const VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &(VkPushConstantRange){
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = push_size
+        }
+    };
+    VK_ASSERT(vkCreatePipelineLayout(state.v.device, &pipeline_layout_info, NULL, &pipeline->layout), "create compute pipeline layout");
+
+    const VkComputePipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = comp_shader, .pName = "main"
+        },
+        .layout = pipeline->layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1
+    };
+
+    const double start = VK_GETTIME();
+    VK_ASSERT(vkCreateComputePipelines(state.v.device, state.v.pipelineCache, 1, &pipeline_info, NULL, &pipeline->pipeline), "create compute pipeline");
+    const double elapsed_ms = (VK_GETTIME() - start) * 1000.0;
+    printf("Pipeline %s: %.2f ms\n", comp_name, elapsed_ms);
+    state.v.pipelineCreateMs += elapsed_ms;
+
+    vkDestroyShaderModule(state.v.device, comp_shader, NULL);
+    free_shader(&comp);
+}
+
+static void create_mesh_buffer(const vertex_t *vertices, const uint32_t vertex_count, mesh_buffer_t *buffer)
+{
+    const VkDeviceSize buffer_size = sizeof(vertex_t) * vertex_count;
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_memory;
+    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging_buffer,
+                  &staging_memory);
+
+    void *data;
+    vkMapMemory(state.v.device, staging_memory, 0, buffer_size, 0, &data);
+    memcpy(data, vertices, (size_t)buffer_size);
+    vkUnmapMemory(state.v.device, staging_memory);
+    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer->buffer, &buffer->memory);
+
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    vkBeginCommandBuffer(state.v.loadingCommandBuffer, &begin_info);
+    const VkBufferCopy copy_region = {
+        .size = buffer_size
+    };
+
+    vkCmdCopyBuffer(state.v.loadingCommandBuffer, staging_buffer, buffer->buffer, 1, &copy_region);
+    vkEndCommandBuffer(state.v.loadingCommandBuffer);
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &state.v.loadingCommandBuffer
+    };
+
+    vkQueueSubmit(state.v.graphicsQueue, 1, &submit_info, VK_NULL_HANDLE);
+    vkQueueWaitIdle(state.v.graphicsQueue);
+    vkDestroyBuffer(state.v.device, staging_buffer, NULL);
+    vkFreeMemory(state.v.device, staging_memory, NULL);
+    buffer->vertex_count = vertex_count;
+}
+
+static void create_cube_mesh(void)
+{
+    const float half_size = SIZE;
+    const float tile_scale = TILE_SCALE;
+
+    const vertex_t cube_vertices[] = {
+        {{-half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size, -half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size,  half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+
+        {{ half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{-half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{-half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{ half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{-half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{ half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+
+        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{-half_size, -half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{-half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{-half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+
+        {{ half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{ half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{ half_size,  half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+
+        {{-half_size,  half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size,  half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+
+        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
+        {{ half_size, -half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
+        {{ half_size, -half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
+        {{-half_size, -half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
+    };
+    state.v.cube_buffer.vertex_count = 36;
+    create_mesh_buffer(cube_vertices, state.v.cube_buffer.vertex_count, &state.v.cube_buffer);
+}
+
+void VK_READBACK(const readback_fn callback, void *user)
+{
+    ASSERT(config.headless, "framebuffer readback is only supported in headless mode");
+    state.v.readbackCallback = callback;
+    state.v.readbackUser = user;
+}
+
+static void record_readback(const uint32_t image_index)
+{
+    // Pick a free slot, the buffers are created on first use so normal runs pay nothing
+    readback_t *slot = NULL;
+    for (uint32_t i = 0; i < READBACK_SLOTS && !slot; i++)
+        if (!state.v.readbacks[i].pending) slot = &state.v.readbacks[i];
+    ASSERT(slot, "all readback slots are pending");
+
+    const VkDeviceSize size = (VkDeviceSize) state.v.swapChainExtent.width * state.v.swapChainExtent.height * 4;
+    if (!slot->buffer)
+    {
+        create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      &slot->buffer, &slot->memory);
+        vkMapMemory(state.v.device, slot->memory, 0, size, 0, &slot->mapped);
+    }
+
+    // The render pass leaves the offscreen image in TRANSFER_SRC, but its colour writes still need to be made visible
+    const VkImageMemoryBarrier image_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = state.v.images[image_index],
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+    };
+    vkCmdPipelineBarrier(state.v.commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &image_barrier);
+
+    const VkBufferImageCopy region = {
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageExtent = {state.v.swapChainExtent.width, state.v.swapChainExtent.height, 1}
+    };
+    vkCmdCopyImageToBuffer(state.v.commandBuffer, state.v.images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           slot->buffer, 1, &region);
+
+    const VkBufferMemoryBarrier buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slot->buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(state.v.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, NULL, 1, &buffer_barrier, 0, NULL);
+
+    slot->pending = true;
+    slot->frame = state.v.frameIndex;
+    slot->callback = state.v.readbackCallback;
+    slot->user = state.v.readbackUser;
+    state.v.readbackCallback = NULL;
+    state.v.readbackUser = NULL;
+}
+
+// Stretches the scene's render area over the whole swapchain image and hands that to the HUD pass.
+// The image's previous contents are discarded; the submit waits for it to be acquired at the transfer stage.
+static void record_upscale(const uint32_t image_index)
+{
+    const VkImageMemoryBarrier to_transfer[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = state.v.sceneImage,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = state.v.images[image_index],
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+        }
+    };
+    vkCmdPipelineBarrier(state.v.commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, to_transfer);
+
+    const VkImageBlit blit = {
+        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .srcOffsets = {{0, 0, 0}, {(int32_t) state.v.sceneExtent.width, (int32_t) state.v.sceneExtent.height, 1}},
+        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .dstOffsets = {{0, 0, 0}, {(int32_t) state.v.swapChainExtent.width, (int32_t) state.v.swapChainExtent.height, 1}}
+    };
+    vkCmdBlitImage(state.v.commandBuffer, state.v.sceneImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   state.v.images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+    const VkImageMemoryBarrier to_attachment = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = state.v.images[image_index],
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+    };
+    vkCmdPipelineBarrier(state.v.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         0, 0, NULL, 0, NULL, 1, &to_attachment);
+}
+
+// Pixel count tracks GPU time closely enough on a fill-bound scene that the scale moves by the square
+// root of how far the last measured frame was from the middle of the band, at most a step per frame
+static void update_render_scale(void)
+{
+    const double budget = config.dynamic_res_ms;
+    if (budget > 0.0 && state.gpu_frame_ms > 0.0 &&
+        (state.gpu_frame_ms > budget || state.gpu_frame_ms < budget * RENDER_SCALE_HEADROOM))
+    {
+        const float wanted = state.render_scale * sqrtf((float) (budget * (1.0 + RENDER_SCALE_HEADROOM) * 0.5 / state.gpu_frame_ms));
+        const float step = glm_clamp(wanted - state.render_scale, -RENDER_SCALE_STEP, RENDER_SCALE_STEP);
+        state.render_scale = glm_clamp(state.render_scale + step, RENDER_SCALE_MIN, 1.0f);
+    }
+
+    const uint32_t width = (uint32_t) ((float) state.v.swapChainExtent.width * state.render_scale + 0.5f);
+    const uint32_t height = (uint32_t) ((float) state.v.swapChainExtent.height * state.render_scale + 0.5f);
+    state.v.sceneExtent = (VkExtent2D){width ? width : 1, height ? height : 1};
+}
+
+// Hands finished copies to their callbacks, only frames whose fence has been waited on are touched
+static void resolve_readbacks(const bool all)
+{
+    for (uint32_t i = 0; i < READBACK_SLOTS; i++)
+    {
+        readback_t *slot = &state.v.readbacks[i];
+        if (!slot->pending || (!all && slot->frame + MAX_FRAMES_IN_FLIGHT > state.v.frameIndex)) continue;
+
+        slot->pending = false;
+        slot->callback((const uint8_t *) slot->mapped, state.v.swapChainExtent.width, state.v.swapChainExtent.height, slot->user);
+    }
+}
+
+static double gpu_ticks_to_ms(const uint64_t begin, const uint64_t end)
+{
+    const uint64_t mask = state.v.timestampValidBits >= 64 ? UINT64_MAX : (1ull << state.v.timestampValidBits) - 1;
+    return (double) ((end - begin) & mask) * state.v.deviceProperties.limits.timestampPeriod * 1e-6;
+}
+
+// Publishes the newest finished frame, anything the GPU has not reached yet stays pending
+static void resolve_gpu_queries(void)
+{
+    for (uint32_t i = 0; i < GPU_QUERY_FRAMES; i++)
+    {
+        gpu_query_frame_t *frame = &state.v.gpuQueries[i];
+        if (!frame->pending) continue;
+
+        uint64_t timestamps[2 + MAX_GPU_SCOPES * 2];
+        const uint32_t timestamp_count = 2 + frame->scope_count * 2;
+        if (vkGetQueryPoolResults(state.v.device, frame->timestamps, 0, timestamp_count, sizeof(timestamps), timestamps,
+                                  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) continue;
+
+        uint64_t statistics[MAX_GPU_SCOPES][GPU_STAT_COUNT];
+        if (frame->statistics_count &&
+            vkGetQueryPoolResults(state.v.device, frame->statistics, 0, frame->statistics_count, sizeof(statistics),
+                                  statistics, sizeof(statistics[0]), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) continue;
+
+        frame->pending = false;
+        frametime_gpu(frame->frame, gpu_ticks_to_ms(timestamps[0], timestamps[1]));
+        if (frame->frame < state.v.gpuResultsFrame) continue;
+        state.v.gpuResultsFrame = frame->frame;
+
+        state.gpu_frame_ms = gpu_ticks_to_ms(timestamps[0], timestamps[1]);
+        state.gpu_scope_count = frame->scope_count;
+        for (uint32_t s = 0; s < frame->scope_count; s++)
+        {
+            gpu_scope_t *scope = &state.gpu_scopes[s];
+            *scope = frame->scopes[s];
+            scope->ms = gpu_ticks_to_ms(timestamps[2 + s * 2], timestamps[3 + s * 2]);
+            scope->has_stats = frame->statistics_query[s] != UINT32_MAX;
+            if (scope->has_stats) memcpy(scope->stats, statistics[frame->statistics_query[s]], sizeof(scope->stats));
+        }
+    }
+}
+
+static void begin_gpu_queries(void)
+{
+    if (!state.v.timestampValidBits) return;
+
+    gpu_query_frame_t *frame = &state.v.gpuQueries[state.v.frameIndex % GPU_QUERY_FRAMES];
+    frame->pending = false; // still unresolved after a full ring, drop it
+    frame->frame = state.v.frameIndex;
+    frame->scope_count = 0;
+    frame->statistics_count = 0;
+    state.v.gpuQueryFrame = frame;
+    state.v.gpuScopeDepth = 0;
+
+    vkCmdResetQueryPool(state.v.commandBuffer, frame->timestamps, 0, 2 + MAX_GPU_SCOPES * 2);
+    if (frame->statistics) vkCmdResetQueryPool(state.v.commandBuffer, frame->statistics, 0, MAX_GPU_SCOPES);
+    vkCmdWriteTimestamp(state.v.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->timestamps, 0);
+}
+
+static void end_gpu_queries(void)
+{
+    gpu_query_frame_t *frame = state.v.gpuQueryFrame;
+    if (!frame) return;
+
+    ASSERT(state.v.gpuScopeDepth == 0, "VK_GPU_SCOPE_BEGIN without matching VK_GPU_SCOPE_END");
+    vkCmdWriteTimestamp(state.v.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamps, 1);
+    frame->pending = true;
+    state.v.gpuQueryFrame = NULL;
+}
+
+// Where the vk_cmd_* wrappers and GPU scopes record: the frame's command buffer, or with --parallel-record
+// the secondary of the current segment on the main thread and of its slice on a worker
+static _Thread_local VkCommandBuffer recording_buffer;
+static _Thread_local bool recording_slice;
+
+// Commands recorded this frame on every thread, VK_FRAME hands them to state once recording is done
+static struct
+{
+    _Atomic uint32_t pipeline_binds;
+    _Atomic uint32_t set_binds;
+    _Atomic uint32_t draws;
+} command_counts;
+
+static _Atomic uint32_t draw_uniform_count; // slots of the ring handed out this frame
+
+void VK_GPU_SCOPE_BEGIN(const char *name)
+{
+    ASSERT(!recording_slice, "GPU scopes cannot be opened inside a vk_cmd_parallel slice");
+    if (state.capturing) capture_scope_begin(name);
+    gpu_query_frame_t *frame = state.v.gpuQueryFrame;
+    if (!frame) return;
+    ASSERT(state.v.gpuScopeDepth < MAX_GPU_SCOPES, "GPU scopes nested too deeply");
+
+    // Out of scopes, keep the nesting balanced but stop recording
+    const uint32_t index = frame->scope_count;
+    state.v.gpuScopeStack[state.v.gpuScopeDepth++] = index;
+    if (index >= MAX_GPU_SCOPES) return;
+    frame->scope_count++;
+
+    frame->scopes[index] = (gpu_scope_t){.name = name, .depth = state.v.gpuScopeDepth - 1};
+    frame->statistics_query[index] = UINT32_MAX;
+    vkCmdWriteTimestamp(recording_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->timestamps, 2 + index * 2);
+
+    // A query has to begin and end in the same secondary, which a scope around vk_cmd_parallel cannot
+    if (frame->statistics && state.v.gpuScopeDepth == 1 && !config.parallel_record)
+    {
+        frame->statistics_query[index] = frame->statistics_count;
+        vkCmdBeginQuery(recording_buffer, frame->statistics, frame->statistics_count++, 0);
+    }
+}
+
+void VK_GPU_SCOPE_END(void)
+{
+    ASSERT(!recording_slice, "GPU scopes cannot be closed inside a vk_cmd_parallel slice");
+    if (state.capturing) capture_scope_end();
+    gpu_query_frame_t *frame = state.v.gpuQueryFrame;
+    if (!frame) return;
+    ASSERT(state.v.gpuScopeDepth > 0, "VK_GPU_SCOPE_END without VK_GPU_SCOPE_BEGIN");
+
+    const uint32_t index = state.v.gpuScopeStack[--state.v.gpuScopeDepth];
+    if (index >= MAX_GPU_SCOPES) return;
+
+    vkCmdWriteTimestamp(recording_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamps, 3 + index * 2);
+    if (frame->statistics_query[index] != UINT32_MAX)
+        vkCmdEndQuery(recording_buffer, frame->statistics, frame->statistics_query[index]);
+}
+
+void vk_cmd_bind_pipeline(const pipeline_t *pipeline)
+{
+    vk_cmd_bind_pipeline_variant(pipeline, PIPELINE_VARIANT_DEFAULT);
+}
+
+void vk_cmd_bind_pipeline_variant(const pipeline_t *pipeline, const pipeline_variant_t variant)
+{
+    const VkPipeline handle = variant == PIPELINE_VARIANT_PREPASS ? pipeline->prepass
+                            : variant == PIPELINE_VARIANT_EQUAL ? pipeline->equal
+                            : pipeline->pipeline;
+    ASSERT(handle, "pipeline missing, --lazy-init ones arrive at a frame boundary and only opaque ones have variants");
+    if (state.capturing) capture_bind_pipeline(pipeline, variant);
+    atomic_fetch_add_explicit(&command_counts.pipeline_binds, 1, memory_order_relaxed);
+    vkCmdBindPipeline(recording_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, handle);
+}
+
+void vk_cmd_bind_set(const pipeline_t *pipeline, const VkDescriptorSet set)
+{
+    if (state.capturing) capture_bind_set(pipeline, set);
+    atomic_fetch_add_explicit(&command_counts.set_binds, 1, memory_order_relaxed);
+    vkCmdBindDescriptorSets(recording_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 1, 1, &set, 0, NULL);
+}
+
+// The fence was waited on before recording, so the ring refills from the start every frame. Slices take
+// slots at the same time, each only rebinds set 0 at its own offset.
+void vk_cmd_draw_uniforms(const pipeline_t *pipeline, const draw_uniforms_t *uniforms)
+{
+    if (state.capturing) capture_draw_uniforms(pipeline, uniforms);
+    const uint32_t slot = atomic_fetch_add_explicit(&draw_uniform_count, 1, memory_order_relaxed);
+    ASSERT(slot < MAX_DRAW_UNIFORMS, "more than MAX_DRAW_UNIFORMS draw uniforms in one frame");
+
+    const uint32_t offset = slot * state.v.draw_uniform_stride;
+    memcpy(state.v.draw_uniforms + offset, uniforms, sizeof(draw_uniforms_t));
+    atomic_fetch_add_explicit(&command_counts.set_binds, 1, memory_order_relaxed);
+    vkCmdBindDescriptorSets(recording_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, 1,
+                            &state.v.frameSet, 1, &offset);
+}
+
+void vk_set_camera(const camera_uniforms_t *camera)
+{
+    if (state.capturing) capture_camera(camera);
+    state.camera = *camera;
+    *state.v.camera = *camera;
+}
+
+static void update_camera(void)
+{
+    camera_uniforms_t camera;
+    glm_mat4_identity(camera.view);
+    glm_rotate(camera.view, state.cam.pitch, (vec3){1.0f, 0.0f, 0.0f});
+    glm_rotate(camera.view, state.cam.yaw, (vec3){0.0f, 1.0f, 0.0f});
+    glm_translate(camera.view, (vec3){-state.cam.x, -state.cam.y, -state.cam.z});
+
+    glm_perspective(glm_rad(FOV_DEGREES), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE, camera.proj);
+    glm_mat4_mul(camera.proj, camera.view, camera.view_proj);
+    vk_set_camera(&camera);
+}
+
+void vk_cmd_bind_vertices(const mesh_buffer_t *buffer)
+{
+    ASSERT(buffer->buffer, "vertex buffer bound before it was created, --lazy-init ones arrive at a frame boundary");
+    if (state.capturing) capture_bind_vertices(buffer);
+    const VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(recording_buffer, 0, 1, &buffer->buffer, &offset);
+}
+
+void vk_cmd_draw(const uint32_t vertex_count, const uint32_t first_vertex)
+{
+    if (state.capturing) capture_draw(vertex_count, first_vertex);
+    atomic_fetch_add_explicit(&command_counts.draws, 1, memory_order_relaxed);
+    vkCmdDraw(recording_buffer, vertex_count, 1, first_vertex, 0);
+}
+
+static pthread_mutex_t instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The fence was waited on before recording, so the instance and indirect buffers are free to overwrite.
+// Instances past MAX_CUBE_INSTANCES for the frame are dropped, ranges past MAX_CULL_BATCHES go unculled.
+// Any thread can stage at the same time, only handing out the ranges is serialised.
+instance_range_t vk_stage_instances(const uint32_t vertex_count, const cube_instance_t *instances, uint32_t count,
+                                    mat4 view_proj)
+{
+    pthread_mutex_lock(&instance_lock);
+    if (count > MAX_CUBE_INSTANCES - state.v.instance_count) count = MAX_CUBE_INSTANCES - state.v.instance_count;
+    const uint32_t first_instance = state.v.instance_count;
+    state.v.instance_count += count;
+    const bool culled = count && state.v.cullSet && state.v.cull_batch_count < MAX_CULL_BATCHES;
+    const uint32_t batch = culled ? state.v.cull_batch_count++ : 0;
+    pthread_mutex_unlock(&instance_lock);
+
+    const instance_range_t range = {.first = first_instance, .count = count, .batch = culled ? batch : UINT32_MAX};
+    if (count == 0) return range;
+    memcpy(state.v.instances + first_instance, instances, sizeof(cube_instance_t) * count);
+    if (!culled) return range;
+
+    push_constants_cull_t *cull = &state.v.cull_batches[batch];
+    glm_frustum_planes(view_proj, cull->planes);
+    cull->first = first_instance;
+    cull->count = count;
+    cull->batch = batch;
+    cull->radius = SIZE * 1.7320508f; // half the diagonal of the cube mesh
+    state.v.indirect_commands[batch] = (VkDrawIndirectCommand){.vertexCount = vertex_count};
+    return range;
+}
+
+// A culled range draws indirectly from the culling pass's count, so drawing it again reuses that result
+void vk_cmd_draw_staged(const uint32_t vertex_count, const instance_range_t *range)
+{
+    if (range->count == 0) return;
+    if (state.capturing)
+        capture_draw_instances(vertex_count, state.v.instances + range->first, range->count, state.camera.view_proj);
+    atomic_fetch_add_explicit(&command_counts.draws, 1, memory_order_relaxed);
+
+    if (range->batch == UINT32_MAX)
+    {
+        const VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(recording_buffer, 1, 1, &state.v.instanceBuffer, &offset);
+        vkCmdDraw(recording_buffer, vertex_count, range->count, 0, range->first);
+        return;
+    }
+
+    // The vertex buffer offset picks the batch's range, so firstInstance stays 0 and the indirect draw
+    // does not need drawIndirectFirstInstance
+    const VkDeviceSize offset = sizeof(cube_instance_t) * range->first;
+    vkCmdBindVertexBuffers(recording_buffer, 1, 1, &state.v.visibleBuffer, &offset);
+    vkCmdDrawIndirect(recording_buffer, state.v.indirectBuffer, sizeof(VkDrawIndirectCommand) * range->batch, 1,
+                      sizeof(VkDrawIndirectCommand));
+}
+
+void vk_cmd_draw_instances(const uint32_t vertex_count, const cube_instance_t *instances, const uint32_t count, mat4 view_proj)
+{
+    const instance_range_t range = vk_stage_instances(vertex_count, instances, count, view_proj);
+    vk_cmd_draw_staged(vertex_count, &range);
+}
+
+static void set_viewport(const VkCommandBuffer buffer, const VkExtent2D extent)
+{
+    const VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float) extent.width,
+        .height = (float) extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f
+    };
+    const VkRect2D scissor = {.offset = {0, 0}, .extent = extent};
+
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+}
+
+// Secondaries inherit no dynamic state, each sets the scene viewport again
+static void begin_secondary(const VkCommandBuffer buffer)
+{
+    const VkCommandBufferInheritanceInfo inheritance = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = state.v.renderPass,
+        .subpass = 0,
+        .framebuffer = state.v.recordFramebuffer
+    };
+
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance
+    };
+
+    VK_ASSERT(vkBeginCommandBuffer(buffer, &begin_info), "begin secondary command buffer");
+    set_viewport(buffer, state.v.sceneExtent);
+    recording_buffer = buffer;
+}
+
+// Segments come from commandPool, which only the main thread touches
+static void begin_segment(void)
+{
+    ASSERT(state.v.record_segment_count < MAX_RECORD_SEGMENTS, "too many vk_cmd_parallel calls in one frame");
+    const VkCommandBuffer buffer = state.v.segmentBuffers[state.v.record_segment_count++];
+    begin_secondary(buffer);
+    state.v.executeBuffers[state.v.execute_count++] = buffer;
+}
+
+typedef struct
+{
+    record_fn fn;
+    void *user;
+    uint32_t first; // recordPools slot of slice 0
+} record_range_t;
+
+// Each slot's pool is only ever used by the one thread recording that slice, so it needs no lock
+static void record_slice(void *user, const uint32_t slice)
+{
+    const record_range_t *range = user;
+    const uint32_t slot = range->first + slice;
+
+    VK_ASSERT(vkResetCommandPool(state.v.device, state.v.recordPools[slot], 0), "reset record pool");
+    begin_secondary(state.v.recordBuffers[slot]);
+    recording_slice = true;
+    range->fn(range->user, slice);
+    recording_slice = false;
+    VK_ASSERT(vkEndCommandBuffer(state.v.recordBuffers[slot]), "end slice command buffer");
+}
+
+void vk_cmd_parallel(const record_fn fn, void *user, const uint32_t count)
+{
+    ASSERT(!recording_slice, "vk_cmd_parallel inside a slice");
+
+    if (!config.parallel_record)
+    {
+        for (uint32_t i = 0; i < count; i++) fn(user, i);
+        return;
+    }
+    if (count == 0) return;
+    ASSERT(state.v.record_slice_count + count <= MAX_RECORD_SLICES, "too many vk_cmd_parallel slices in one frame");
+
+    VK_ASSERT(vkEndCommandBuffer(recording_buffer), "end segment command buffer");
+    const record_range_t range = {.fn = fn, .user = user, .first = state.v.record_slice_count};
+    state.v.record_slice_count += count;
+
+    // A capture is a single stream in recording order, so the slices take turns on this thread for it
+    if (state.capturing)
+        for (uint32_t i = 0; i < count; i++) record_slice((void *) &range, i);
+    else
+        jobs_parallel_for("record_slice", record_slice, (void *) &range, count);
+
+    for (uint32_t i = 0; i < count; i++) state.v.executeBuffers[state.v.execute_count++] = state.v.recordBuffers[range.first + i];
+    begin_segment();
+}
+
+VkDescriptorSet font_descriptor_set;
+VkDescriptorSet board_descriptor_set;
+
+// Each phase is timed on the monotonic clock and doubles as a CPU zone, so startup shows up in traces too
+static double startup_begin_time;
+static double startup_phase_time;
+
+static void startup_begin(const char *name)
+{
+    VK_ZONE_BEGIN(name);
+    startup_phase_time = VK_GETTIME();
+    if (state.startup_phase_count < MAX_STARTUP_PHASES)
+        state.startup_phases[state.startup_phase_count].name = name;
+}
+
+static void startup_end(void)
+{
+    if (state.startup_phase_count < MAX_STARTUP_PHASES)
+        state.startup_phases[state.startup_phase_count++].ms = (VK_GETTIME() - startup_phase_time) * 1000.0;
+    VK_ZONE_END();
+}
+
+// Startup tasks, VK_START runs these on the job pool so file reads, PNG decoding and pipeline creation
+// overlap with device setup and with each other. Only the main thread touches the queue.
+typedef struct
+{
+    const char *path;
+    stbi_uc *pixels;
+    int width;
+    int height;
+} decode_task_t;
+
+typedef struct
+{
+    shader_file_t vert;
+    shader_file_t frag;
+    pipeline_t *pipeline;
+    const VkDescriptorSetLayout *set_layout; // NULL for the untextured pipeline, read once the layouts exist
+    bool instanced;
+    bool opaque; // gets the --depth-prepass variants
+    bool wanted;
+    job_t reads[2];
+    job_t create;
+    double ms;
+} pipeline_task_t;
+
+static void load_shader_task(void *user)
+{
+    load_shader(user);
+}
+
+// Textures in the resource pack need no decode, the upload reads them from the mapping
+static void decode_task(void *user)
+{
+    decode_task_t *task = user;
+    if (packed_texture(task->path)) return;
+    int channels;
+    task->pixels = stbi_load(task->path, &task->width, &task->height, &channels, STBI_rgb_alpha);
+}
+
+static void pipeline_task(void *user)
+{
+    pipeline_task_t *task = user;
+    task->ms = create_pipeline_from_code(task->vert.name, task->vert.code, task->vert.size,
+                                         task->frag.code, task->frag.size,
+                                         task->set_layout ? *task->set_layout : VK_NULL_HANDLE, task->instanced,
+                                         task->opaque, task->pipeline);
+}
+
+// Embedded shaders are a table lookup, only files read from disk are worth a job
+static void pipeline_task_read(pipeline_task_t *task)
+{
+    shader_file_t *shaders[2] = {&task->vert, &task->frag};
+    for (uint32_t i = 0; i < 2; i++)
+        if (!load_embedded_shader(shaders[i]))
+            task->reads[i] = job_add("read_shader", load_shader_task, shaders[i], NULL, 0);
+}
+
+// cull.comp reads binding 0 (every instance of the frame), writes the survivors to binding 1 and counts
+// them into the indirect commands at binding 2
+static void create_cull_resources(void)
+{
+    if (!state.v.gpuCulling) return;
+
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; i++)
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+        };
+
+    const VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 3,
+        .pBindings = bindings
+    };
+    VK_ASSERT(vkCreateDescriptorSetLayout(state.v.device, &layout_info, NULL, &state.v.cullSetLayout), "create cull set layout");
+
+    const VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &(VkDescriptorPoolSize){.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 3}
+    };
+    VK_ASSERT(vkCreateDescriptorPool(state.v.device, &pool_info, NULL, &state.v.cullPool), "create cull descriptor pool");
 
-    vkDestroyShaderModule(state.v.device, vert_shader, NULL);
-    vkDestroyShaderModule(state.v.device, frag_shader, NULL);
-    free(vert_code);
-    free(frag_code);
-}
+    const VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = state.v.cullPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &state.v.cullSetLayout
+    };
+    VK_ASSERT(vkAllocateDescriptorSets(state.v.device, &alloc_info, &state.v.cullSet), "allocate cull descriptor set");
+
+    create_buffer(sizeof(cube_instance_t) * MAX_CUBE_INSTANCES,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state.v.visibleBuffer, &state.v.visibleMemory);
+    create_buffer(sizeof(VkDrawIndirectCommand) * MAX_CULL_BATCHES,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  &state.v.indirectBuffer, &state.v.indirectMemory);
+    VK_ASSERT(vkMapMemory(state.v.device, state.v.indirectMemory, 0, VK_WHOLE_SIZE, 0, (void **) &state.v.indirect_commands),
+              "map indirect buffer");
+
+    const VkBuffer buffers[3] = {state.v.instanceBuffer, state.v.visibleBuffer, state.v.indirectBuffer};
+    VkDescriptorBufferInfo buffer_infos[3];
+    VkWriteDescriptorSet writes[3];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        buffer_infos[i] = (VkDescriptorBufferInfo){.buffer = buffers[i], .offset = 0, .range = VK_WHOLE_SIZE};
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = state.v.cullSet,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[i]
+        };
+    }
+    vkUpdateDescriptorSets(state.v.device, 3, writes, 0, NULL);
 
-static void create_mesh_buffer(const vertex_t *vertices, const uint32_t vertex_count, mesh_buffer_t *buffer)
-{
-    const VkDeviceSize buffer_size = sizeof(vertex_t) * vertex_count;
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_memory;
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging_buffer,
-                  &staging_memory);
+    const VkCommandBufferAllocateInfo command_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = state.v.commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+    VK_ASSERT(vkAllocateCommandBuffers(state.v.device, &command_info, &state.v.cullCommandBuffer), "allocate cull command buffer");
 
-    void *data;
-    vkMapMemory(state.v.device, staging_memory, 0, buffer_size, 0, &data);
-    memcpy(data, vertices, (size_t)buffer_size);
-    vkUnmapMemory(state.v.device, staging_memory);
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer->buffer, &buffer->memory);
+    create_compute_pipeline("cull.comp.spv", state.v.cullSetLayout, sizeof(push_constants_cull_t), &state.v.cull_pipeline);
+}
 
+// Every batch VK_FRAME collected while recording, the barrier hands the counts and survivors to the
+// indirect draws in the frame's command buffer, which is submitted right after this one
+static void record_culling(void)
+{
+    const VkCommandBuffer cmd = state.v.cullCommandBuffer;
     const VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
 
-    vkBeginCommandBuffer(state.v.loadingCommandBuffer, &begin_info);
-    const VkBufferCopy copy_region = {
-        .size = buffer_size
-    };
+    vkResetCommandBuffer(cmd, 0);
+    vkBeginCommandBuffer(cmd, &begin_info);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, state.v.cull_pipeline.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, state.v.cull_pipeline.layout, 0, 1, &state.v.cullSet, 0, NULL);
+    for (uint32_t i = 0; i < state.v.cull_batch_count; i++)
+    {
+        const push_constants_cull_t *batch = &state.v.cull_batches[i];
+        vkCmdPushConstants(cmd, state.v.cull_pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_cull_t), batch);
+        vkCmdDispatch(cmd, (batch->count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    }
 
-    vkCmdCopyBuffer(state.v.loadingCommandBuffer, staging_buffer, buffer->buffer, 1, &copy_region);
-    vkEndCommandBuffer(state.v.loadingCommandBuffer);
-    const VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &state.v.loadingCommandBuffer
+    // The host reads the counts back once the frame's fence has signalled
+    const VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_HOST_READ_BIT
     };
-
-    vkQueueSubmit(state.v.graphicsQueue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(state.v.graphicsQueue);
-    vkDestroyBuffer(state.v.device, staging_buffer, NULL);
-    vkFreeMemory(state.v.device, staging_memory, NULL);
-    buffer->vertex_count = vertex_count;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+    vkEndCommandBuffer(cmd);
 }
 
-static void create_cube_mesh(void)
+// --lazy-init only, VK_START otherwise builds these from its startup tasks.
+// Nothing the first frame draws, main.c only reaches them through VK_DRAWCUBE(S) and the fallback texture.
+static void create_deferred_resources(void)
 {
-    const float half_size = SIZE;
-    const float tile_scale = TILE_SCALE;
-
-    const vertex_t cube_vertices[] = {
-        {{-half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size, -half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size,  half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-
-        {{ half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{-half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{-half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{ half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{-half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{ half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-
-        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{-half_size, -half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{-half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{-half_size,  half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-
-        {{ half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{ half_size, -half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{ half_size,  half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-
-        {{-half_size,  half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size,  half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size,  half_size,  half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size,  half_size, -half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size,  half_size, -half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-
-        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size, -half_size, -half_size}, {tile_scale, 0.0f},        {1, 1 ,1, 1}},
-        {{ half_size, -half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size, -half_size, -half_size}, {0.0f,       0.0f},        {1, 1 ,1, 1}},
-        {{ half_size, -half_size,  half_size}, {tile_scale, tile_scale},  {1, 1 ,1, 1}},
-        {{-half_size, -half_size,  half_size}, {0.0f,       tile_scale},  {1, 1 ,1, 1}},
-    };
-    state.v.cube_buffer.vertex_count = 36;
-    create_mesh_buffer(cube_vertices, state.v.cube_buffer.vertex_count, &state.v.cube_buffer);
+    create_texture_from_file("Engine/res/checker.png", TEXTURE_DEFAULT, &state.v.board_texture);
+    create_descriptor_set(&state.v.board_texture, &board_descriptor_set);
+    create_pipeline("col.vert.spv", "col.frag.spv", VK_NULL_HANDLE, false, false, &state.v.colored_pipeline);
+    create_pipeline("cube.vert.spv", "cube.frag.spv", state.v.textureSetLayout, true, true, &state.v.instanced_pipeline);
+    create_cube_mesh();
+    create_cull_resources();
 }
 
-VkDescriptorSet font_descriptor_set;
-VkDescriptorSet board_descriptor_set;
+void vk_load_deferred(void)
+{
+    if (!state.v.deferredPending) return;
+    state.v.deferredPending = false;
+
+    VK_ZONE_BEGIN("load_deferred");
+    const double start = VK_GETTIME();
+    create_deferred_resources();
+    printf("Deferred resources: %.2f ms (frame %llu)\n", (VK_GETTIME() - start) * 1000.0,
+           (unsigned long long) state.v.frameIndex);
+    VK_ZONE_END();
+}
 
 void VK_START()
 {
     state = (state_t){0};
-    state.v.texture_count = 0;
-    for (uint32_t i = 0; i < MAX_TEXTURES; i++)
-        state.v.texture_cache[i].loaded = false;
+    startup_begin_time = VK_GETTIME();
 
     {
         glyphs[':'] = (glyph_uv_t){10, 3};
@@ -874,18 +2611,49 @@ void VK_START()
         state.cam.yaw = 0.0f; state.cam.pitch = 0.0f;
     }
 
-    ASSERT(glfwInit(), "Window initialization failed");
-    ASSERT(glfwVulkanSupported(), "GLFW: Vulkan not supported!\n");
+    // Nothing these read needs the device, they run while the main thread brings Vulkan up
+    decode_task_t font_decode = {.path = "Engine/res/font.png"};
+    decode_task_t board_decode = {.path = "Engine/res/checker.png"};
+    pipeline_task_t pipelines[] = {
+        {.vert.name = "tex.vert.spv", .frag.name = "tex.frag.spv",
+         .pipeline = &state.v.textured_pipeline, .set_layout = &state.v.textureSetLayout, .opaque = true, .wanted = true},
+        {.vert.name = "text.vert.spv", .frag.name = "text.frag.spv",
+         .pipeline = &state.v.text_pipeline, .set_layout = &state.v.textureSetLayout, .wanted = true},
+        {.vert.name = "col.vert.spv", .frag.name = "col.frag.spv",
+         .pipeline = &state.v.colored_pipeline, .wanted = !config.lazy_init},
+        {.vert.name = "cube.vert.spv", .frag.name = "cube.frag.spv", .pipeline = &state.v.instanced_pipeline,
+         .set_layout = &state.v.textureSetLayout, .instanced = true, .opaque = true, .wanted = !config.lazy_init},
+        // Wanted once the device says whether bindless is supported
+        {.vert.name = "level.vert.spv", .frag.name = "level.frag.spv",
+         .pipeline = &state.v.level_pipeline, .set_layout = &state.v.bindlessSetLayout, .opaque = true}
+    };
+    const uint32_t pipeline_count = sizeof(pipelines) / sizeof(pipelines[0]);
+    pipeline_task_t *level_pipeline_task = &pipelines[pipeline_count - 1];
+
+    const job_t font_job = job_add("decode_png", decode_task, &font_decode, NULL, 0);
+    const job_t board_job = config.lazy_init ? 0 : job_add("decode_png", decode_task, &board_decode, NULL, 0);
+    for (uint32_t i = 0; i < pipeline_count; i++)
+        if (pipelines[i].wanted) pipeline_task_read(&pipelines[i]);
+
+    // Headless runs never touch GLFW: no window, surface or swapchain, frames go to offscreen images
+    startup_begin("window");
+    if (!config.headless)
+    {
+        ASSERT(glfwInit(), "Window initialization failed");
+        ASSERT(glfwVulkanSupported(), "GLFW: Vulkan not supported!\n");
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-    state.glfw.win = glfwCreateWindow(WIDTH, HEIGHT, TITLE, NULL, NULL);
-    ASSERT(state.glfw.win, "Window creation failed");
+        state.glfw.win = glfwCreateWindow(WIDTH, HEIGHT, TITLE, NULL, NULL);
+        ASSERT(state.glfw.win, "Window creation failed");
+    }
+    startup_end();
 
+    startup_begin("instance");
     {
         uint32_t glfw_ext_count = 0;
-        const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_ext_count);
+        const char **glfw_extensions = config.headless ? NULL : glfwGetRequiredInstanceExtensions(&glfw_ext_count);
         const char **enabled_extensions = (const char **) malloc(sizeof(char *) * (glfw_ext_count + 1));
         uint32_t enabled_ext_count = glfw_ext_count;
 
@@ -910,8 +2678,11 @@ void VK_START()
         free((void *) enabled_extensions);
     }
 
-    VK_ASSERT(glfwCreateWindowSurface(state.v.instance, state.glfw.win, NULL, &state.v.surface), "create surface");
+    if (!config.headless)
+        VK_ASSERT(glfwCreateWindowSurface(state.v.instance, state.glfw.win, NULL, &state.v.surface), "create surface");
+    startup_end();
 
+    startup_begin("device");
     // Select physical device
     {
         uint32_t device_count = 0;
@@ -938,10 +2709,12 @@ void VK_START()
             if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
             {
                 state.v.graphicsFamilyIndex = i;
+                state.v.timestampValidBits = queue_families[i].timestampValidBits;
+                state.v.gpuCulling = !config.no_cull && (queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT);
                 graphics_found = true;
             }
             VkBool32 present_support = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(state.v.physicalDevice, i, state.v.surface, &present_support);
+            if (!config.headless) vkGetPhysicalDeviceSurfaceSupportKHR(state.v.physicalDevice, i, state.v.surface, &present_support);
             if (present_support)
             {
                 state.v.presentFamilyIndex = i;
@@ -950,6 +2723,11 @@ void VK_START()
         }
 
         free(queue_families);
+        if (config.headless)
+        {
+            state.v.presentFamilyIndex = state.v.graphicsFamilyIndex;
+            present_found = true;
+        }
         ASSERT((graphics_found && present_found), "failed to find queue families");
     }
 
@@ -975,12 +2753,74 @@ void VK_START()
             };
         }
 
+        // Anisotropic filtering is optional, mipmapped textures fall back to plain trilinear without it
+        VkPhysicalDeviceFeatures supported_features;
+        vkGetPhysicalDeviceFeatures(state.v.physicalDevice, &supported_features);
+        vkGetPhysicalDeviceProperties(state.v.physicalDevice, &state.v.deviceProperties);
+        const VkPhysicalDeviceProperties properties = state.v.deviceProperties;
+
+        state.v.maxAnisotropy = supported_features.samplerAnisotropy
+                                    ? fminf(MAX_ANISOTROPY, properties.limits.maxSamplerAnisotropy)
+                                    : 0.0f;
+        state.v.pipelineStatistics = supported_features.pipelineStatisticsQuery;
+
+        // Bindless level textures need descriptor indexing (core in 1.2), otherwise walls share one texture
+        VkPhysicalDeviceDescriptorIndexingFeatures indexing_supported = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES
+        };
+        VkPhysicalDeviceDescriptorIndexingProperties indexing_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES
+        };
+        if (properties.apiVersion >= VK_API_VERSION_1_2)
+        {
+            VkPhysicalDeviceFeatures2 features2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &indexing_supported
+            };
+            vkGetPhysicalDeviceFeatures2(state.v.physicalDevice, &features2);
+
+            VkPhysicalDeviceProperties2 properties2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                .pNext = &indexing_properties
+            };
+            vkGetPhysicalDeviceProperties2(state.v.physicalDevice, &properties2);
+        }
+
+        state.v.bindless = indexing_supported.runtimeDescriptorArray &&
+                           indexing_supported.shaderSampledImageArrayNonUniformIndexing &&
+                           indexing_supported.descriptorBindingPartiallyBound &&
+                           indexing_supported.descriptorBindingSampledImageUpdateAfterBind;
+        state.v.bindlessCapacity = MAX_BINDLESS_TEXTURES;
+        if (state.v.bindlessCapacity > indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages)
+            state.v.bindlessCapacity = indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages;
+        if (state.v.bindlessCapacity > indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers)
+            state.v.bindlessCapacity = indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers;
+        if (state.v.bindlessCapacity == 0) state.v.bindless = false;
+
+        VkPhysicalDeviceDescriptorIndexingFeatures indexing_enabled = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+            .runtimeDescriptorArray = state.v.bindless,
+            .shaderSampledImageArrayNonUniformIndexing = state.v.bindless,
+            .descriptorBindingPartiallyBound = state.v.bindless,
+            .descriptorBindingSampledImageUpdateAfterBind = state.v.bindless
+        };
+
+        const VkPhysicalDeviceFeatures2 enabled_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = state.v.bindless ? &indexing_enabled : NULL,
+            .features = {
+                .samplerAnisotropy = supported_features.samplerAnisotropy,
+                .pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery
+            }
+        };
+
         const char *device_extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
         const VkDeviceCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .pNext = &enabled_features,
             .queueCreateInfoCount = queue_info_count,
             .pQueueCreateInfos = queue_create_infos,
-            .enabledExtensionCount = 1,
+            .enabledExtensionCount = config.headless ? 0 : 1,
             .ppEnabledExtensionNames = device_extensions
         };
 
@@ -989,8 +2829,32 @@ void VK_START()
         vkGetDeviceQueue(state.v.device, state.v.graphicsFamilyIndex, 0, &state.v.graphicsQueue);
         vkGetDeviceQueue(state.v.device, state.v.presentFamilyIndex, 0, &state.v.presentQueue);
     }
+    startup_end();
+
+    level_pipeline_task->wanted = state.v.bindless;
+    if (level_pipeline_task->wanted) pipeline_task_read(level_pipeline_task);
+
+    // Create swapchain, or the offscreen colour images standing in for it
+    startup_begin("swapchain");
+    state.render_scale = config.render_scale > 0.0f ? glm_clamp(config.render_scale, RENDER_SCALE_MIN, 1.0f) : 1.0f;
+    state.v.offscreen = config.dynamic_res_ms > 0.0 || state.render_scale < 1.0f;
+    if (config.headless)
+    {
+        state.v.swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+        state.v.swapChainExtent = (VkExtent2D){WIDTH, HEIGHT};
+        state.present_mode = "none";
+        state.v.imageCount = 1;
+        state.v.images = (VkImage *) malloc(sizeof(VkImage) * state.v.imageCount);
+        state.v.imageMemory = (VkDeviceMemory *) malloc(sizeof(VkDeviceMemory) * state.v.imageCount);
+        state.v.imageViews = (VkImageView *) malloc(sizeof(VkImageView) * state.v.imageCount);
+        state.v.framebuffers = (VkFramebuffer *) malloc(sizeof(VkFramebuffer) * state.v.imageCount);
 
-    // Create swapchain
+        for (uint32_t i = 0; i < state.v.imageCount; ++i)
+            create_image(WIDTH, HEIGHT, 1, state.v.swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+                         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state.v.images[i], &state.v.imageMemory[i]);
+    }
+    else
     {
         VkSurfaceCapabilitiesKHR capabilities;
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(state.v.physicalDevice, state.v.surface, &capabilities);
@@ -1016,6 +2880,35 @@ void VK_START()
 
         if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount) image_count = capabilities.maxImageCount;
 
+        // The upscale blits into the swapchain image
+        if (state.v.offscreen && !(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+        {
+            fprintf(stderr, "Warning: Swapchain images cannot be blitted to, rendering at native resolution\n");
+            state.v.offscreen = false;
+        }
+
+        // The requested mode, then the other one that does not wait for vblank, then FIFO which every
+        // surface has. FIFO relaxed only falls back to FIFO.
+        uint32_t mode_count;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(state.v.physicalDevice, state.v.surface, &mode_count, NULL);
+        VkPresentModeKHR *modes = (VkPresentModeKHR *) malloc(sizeof(VkPresentModeKHR) * mode_count);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(state.v.physicalDevice, state.v.surface, &mode_count, modes);
+
+        const VkPresentModeKHR wanted = config.present_mode;
+        VkPresentModeKHR candidates[3] = {wanted, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR};
+        if (wanted == VK_PRESENT_MODE_IMMEDIATE_KHR) candidates[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+        else if (wanted == VK_PRESENT_MODE_MAILBOX_KHR) candidates[1] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+        VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+        for (uint32_t c = 0; c < 3 && present_mode == VK_PRESENT_MODE_FIFO_KHR; c++)
+            for (uint32_t i = 0; i < mode_count; i++)
+                if (modes[i] == candidates[c]) present_mode = candidates[c];
+        free(modes);
+
+        state.present_mode = present_mode_name(present_mode);
+        if (present_mode != wanted)
+            fprintf(stderr, "Warning: Present mode %s not supported, using %s\n", present_mode_name(wanted), state.present_mode);
+
         const uint32_t queue_family_indices[] = {state.v.graphicsFamilyIndex, state.v.presentFamilyIndex};
         const VkSwapchainCreateInfoKHR swapchain_info = {
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
@@ -1025,7 +2918,7 @@ void VK_START()
             .imageColorSpace = surface_format.colorSpace,
             .imageExtent = state.v.swapChainExtent,
             .imageArrayLayers = 1,
-            .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (state.v.offscreen ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
             .imageSharingMode = (state.v.graphicsFamilyIndex != state.v.presentFamilyIndex)
                                     ? VK_SHARING_MODE_CONCURRENT
                                     : VK_SHARING_MODE_EXCLUSIVE,
@@ -1035,7 +2928,7 @@ void VK_START()
                                        : NULL,
             .preTransform = capabilities.currentTransform,
             .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-            .presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR,
+            .presentMode = present_mode,
             .clipped = VK_TRUE
         };
 
@@ -1047,7 +2940,6 @@ void VK_START()
         state.v.framebuffers = (VkFramebuffer *) malloc(sizeof(VkFramebuffer) * state.v.imageCount);
         vkGetSwapchainImagesKHR(state.v.device, state.v.swapchain, &state.v.imageCount, state.v.images);
     }
-
     for (uint32_t i = 0; i < state.v.imageCount; ++i)
     {
         const VkImageViewCreateInfo view_info = {
@@ -1072,7 +2964,9 @@ void VK_START()
 
         VK_ASSERT(vkCreateImageView(state.v.device, &view_info, NULL, &state.v.imageViews[i]), "create image view");
     }
+    startup_end();
 
+    startup_begin("render_pass");
     {
         const VkCommandPoolCreateInfo pool_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -1095,8 +2989,46 @@ void VK_START()
         VK_ASSERT(vkAllocateCommandBuffers(state.v.device, &alloc_info, &state.v.loadingCommandBuffer), "allocate loading command buffer");
     }
 
+    if (config.parallel_record)
+    {
+        const VkCommandBufferAllocateInfo segment_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = state.v.commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = MAX_RECORD_SEGMENTS
+        };
+        VK_ASSERT(vkAllocateCommandBuffers(state.v.device, &segment_info, state.v.segmentBuffers), "allocate segment command buffers");
+
+        // Reset whole each frame by the slice that records into it
+        const VkCommandPoolCreateInfo slice_pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .queueFamilyIndex = state.v.graphicsFamilyIndex,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
+        };
+
+        for (uint32_t i = 0; i < MAX_RECORD_SLICES; i++)
+        {
+            VK_ASSERT(vkCreateCommandPool(state.v.device, &slice_pool_info, NULL, &state.v.recordPools[i]), "create record pool");
+            const VkCommandBufferAllocateInfo slice_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = state.v.recordPools[i],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1
+            };
+            VK_ASSERT(vkAllocateCommandBuffers(state.v.device, &slice_info, &state.v.recordBuffers[i]), "allocate slice command buffer");
+        }
+    }
+
     create_depth_resources();
-    create_render_pass();
+    const VkImageLayout present_layout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    if (state.v.offscreen)
+    {
+        create_render_pass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &state.v.renderPass);
+        create_render_pass(VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, present_layout, &state.v.hudRenderPass);
+        create_scene_target();
+    }
+    else create_render_pass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, present_layout, &state.v.renderPass);
+    state.v.sceneExtent = state.v.swapChainExtent;
     for (uint32_t i = 0; i < state.v.imageCount; ++i)
     {
         const VkImageView attachments[] = {
@@ -1115,20 +3047,32 @@ void VK_START()
         };
         VK_ASSERT(vkCreateFramebuffer(state.v.device, &framebuffer_info, NULL, &state.v.framebuffers[i]), "create framebuffer");
     }
+    startup_end();
 
+    startup_begin("descriptors");
     create_descriptor_set_layout();
     create_descriptor_pool();
-
-    create_texture_from_file("Engine/res/font.png", &state.v.font_texture);
-    create_texture_from_file("Engine/res/checker.png", &state.v.board_texture);
-
+    create_frame_resources();
+    if (state.v.bindless) create_bindless_resources();
+    startup_end();
+
+    // Render pass, set layouts and cache are all pipelines need, they compile while textures upload
+    startup_begin("pipeline_cache");
+    create_pipeline_cache();
+    for (uint32_t i = 0; i < pipeline_count; i++)
+        if (pipelines[i].wanted)
+            pipelines[i].create = job_add("create_pipeline", pipeline_task, &pipelines[i], pipelines[i].reads, 2);
+    startup_end();
+
+    startup_begin("font");
+    jobs_wait(font_job);
+    if (!create_texture_from_pack(font_decode.path, TEXTURE_DEFAULT, &state.v.font_texture))
+        create_texture_from_pixels(font_decode.path, TEXTURE_DEFAULT, font_decode.pixels, font_decode.width,
+                                   font_decode.height, &state.v.font_texture);
     create_descriptor_set(&state.v.font_texture, &font_descriptor_set);
-    create_descriptor_set(&state.v.board_texture, &board_descriptor_set);
-
-    create_pipeline("Engine/shad/col.vert.spv", "Engine/shad/col.frag.spv", false, &state.v.colored_pipeline);
-    create_pipeline("Engine/shad/tex.vert.spv", "Engine/shad/tex.frag.spv", true, &state.v.textured_pipeline);
-    create_pipeline("Engine/shad/text.vert.spv", "Engine/shad/text.frag.spv", true, &state.v.text_pipeline);
+    startup_end();
 
+    startup_begin("buffers");
     {
         const VkDeviceSize buffer_size = sizeof(vertex_t) * MAX_TEXT_VERTICES;
         create_buffer(buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
@@ -1145,8 +3089,32 @@ void VK_START()
         state.v.wall_buffer.vertex_count = 0;
     }
 
-    create_cube_mesh();
+    {
+        const VkDeviceSize buffer_size = sizeof(cube_instance_t) * MAX_CUBE_INSTANCES;
+        create_buffer(buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      &state.v.instanceBuffer, &state.v.instanceMemory);
+        VK_ASSERT(vkMapMemory(state.v.device, state.v.instanceMemory, 0, buffer_size, 0, (void **) &state.v.instances),
+                  "map instance buffer");
+    }
+    startup_end();
 
+    // The first frame only needs the text and level paths, --lazy-init creates the rest once it is out
+    if (config.lazy_init) state.v.deferredPending = true;
+    else
+    {
+        startup_begin("deferred");
+        jobs_wait(board_job);
+        if (!create_texture_from_pack(board_decode.path, TEXTURE_DEFAULT, &state.v.board_texture))
+            create_texture_from_pixels(board_decode.path, TEXTURE_DEFAULT, board_decode.pixels, board_decode.width,
+                                       board_decode.height, &state.v.board_texture);
+        create_descriptor_set(&state.v.board_texture, &board_descriptor_set);
+        create_cube_mesh();
+        create_cull_resources();
+        startup_end();
+    }
+
+    startup_begin("sync");
     {
         const VkSemaphoreCreateInfo semaphore_info = {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
@@ -1162,14 +3130,109 @@ void VK_START()
 
         VK_ASSERT(vkCreateFence(state.v.device, &fence_info, NULL, &state.v.inFlightFence), "create fence");
     }
+    startup_end();
+
+    // GPU timing, skipped on queues without timestamp support, statistics only where the device has them
+    startup_begin("queries");
+    if (state.v.timestampValidBits)
+    {
+        const VkQueryPoolCreateInfo timestamp_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 + MAX_GPU_SCOPES * 2
+        };
+        // Results come back in bit order, which is the order of gpu_stat_t
+        const VkQueryPoolCreateInfo statistics_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = MAX_GPU_SCOPES,
+            .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                                  VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+        };
+
+        for (uint32_t i = 0; i < GPU_QUERY_FRAMES; i++)
+        {
+            VK_ASSERT(vkCreateQueryPool(state.v.device, &timestamp_info, NULL, &state.v.gpuQueries[i].timestamps), "create timestamp query pool");
+            if (state.v.pipelineStatistics)
+                VK_ASSERT(vkCreateQueryPool(state.v.device, &statistics_info, NULL, &state.v.gpuQueries[i].statistics), "create pipeline statistics query pool");
+        }
+    }
+    startup_end();
+
+    // Whatever is left of pipeline creation, the time here is only what the main thread still waited
+    startup_begin("pipelines");
+    for (uint32_t i = 0; i < pipeline_count; i++)
+    {
+        if (!pipelines[i].wanted) continue;
+        jobs_wait(pipelines[i].create);
+        state.v.pipelineCreateMs += pipelines[i].ms;
+        free_shader(&pipelines[i].vert);
+        free_shader(&pipelines[i].frag);
+    }
+    printf("Pipelines: %.2f ms total (%s cache)\n", state.v.pipelineCreateMs, state.v.pipelineCacheWarm ? "warm" : "cold");
+    startup_end();
+
+    if (config.golden_script) golden_start(config.golden_script);
+    replay_start();
+
+    state.startup_ms = (VK_GETTIME() - startup_begin_time) * 1000.0;
+    printf("Startup: %.2f ms%s\n", state.startup_ms, config.lazy_init ? " (lazy init)" : "");
+    for (uint32_t i = 0; i < state.startup_phase_count; i++)
+        printf("  %-12s %8.2f ms\n", state.startup_phases[i].name, state.startup_phases[i].ms);
 
-    state.last_time = glfwGetTime();
+    state.last_time = VK_GETTIME();
     state.last_frame_time = state.last_time;
+    state.start_time = state.last_time;
+}
+
+// Sleeps to just short of the deadline on the monotonic clock and spins the rest, a sleep can wake
+// late but never early
+static void wait_until(const double deadline)
+{
+    const double wake = deadline - FRAME_SPIN_S;
+    if (wake > VK_GETTIME())
+    {
+        const struct timespec ts = {(time_t) wake, (long) ((wake - (double) (time_t) wake) * 1e9)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    }
+    while (VK_GETTIME() < deadline) {}
+}
+
+// --fps, or UNFOCUSED_FPS in the background. Nothing renders while minimised. A frame that ran more
+// than a period late restarts the schedule instead of rushing the next ones to catch up.
+static void pace_frame(void)
+{
+    static double deadline = 0.0;
+    double fps = config.fps_limit;
+
+    if (!config.headless && !config.no_throttle)
+    {
+        while (glfwGetWindowAttrib(state.glfw.win, GLFW_ICONIFIED) && !glfwWindowShouldClose(state.glfw.win))
+            glfwWaitEventsTimeout(MINIMISED_POLL_S);
+        if (!glfwGetWindowAttrib(state.glfw.win, GLFW_FOCUSED) && (fps <= 0.0 || fps > UNFOCUSED_FPS)) fps = UNFOCUSED_FPS;
+    }
+
+    state.pace_fps = fps > 0.0 ? fps : 0.0;
+    if (fps <= 0.0) return;
+
+    const double period = 1.0 / fps;
+    const double now = VK_GETTIME();
+    if (deadline < now - period) deadline = now;
+    else
+    {
+        VK_ZONE_BEGIN("pace");
+        wait_until(deadline);
+        VK_ZONE_END();
+    }
+    deadline += period;
 }
 
 int VK_FRAME()
 {
-    const double current_time = glfwGetTime();
+    pace_frame();
+    const double current_time = VK_GETTIME();
     state.delta_time = (float) (current_time - state.last_frame_time);
     state.last_frame_time = current_time;
 
@@ -1179,19 +3242,84 @@ int VK_FRAME()
         state.fps = state.frame_count / (current_time - state.last_time);
         state.frame_count = 0;
         state.last_time = current_time;
+        frametime_update();
     }
 
-    glfwPollEvents();
+    profile_frame();
+
+    // The first frame is out, so this is the earliest frame with nothing more urgent to do
+    if (state.v.deferredPending && state.v.frameIndex >= 1) vk_load_deferred();
+
+    if (!config.headless)
+    {
+        VK_ZONE_BEGIN("poll_events");
+        glfwPollEvents();
+        ASSERT(state.glfw.win != NULL, "GLFW window is NULL during input");
+        VK_ZONE_END();
+    }
     fflush(stdout);
-    ASSERT(state.glfw.win != NULL, "GLFW window is NULL during input");
+    const bool replaying = replay_frame();
+
+    // Edge triggered so holding the key writes one trace
+    static bool trace_pressed = false;
+    if (VK_KEYDOWN(PROFILE_TRACE_KEY))
+    {
+        if (!trace_pressed) profile_export(config.trace_path ? config.trace_path : PROFILE_TRACE);
+        trace_pressed = true;
+    }
+    else trace_pressed = false;
+
+    static bool csv_pressed = false;
+    if (VK_KEYDOWN(FRAME_CSV_KEY))
+    {
+        if (!csv_pressed)
+        {
+            frametime_update();
+            frametime_export(config.frames_csv ? config.frames_csv : FRAME_CSV);
+        }
+        csv_pressed = true;
+    }
+    else csv_pressed = false;
+
+    static bool capture_pressed = false;
+    if (VK_KEYDOWN(CAPTURE_KEY))
+    {
+        if (!capture_pressed) capture_start(config.capture_path ? config.capture_path : CAPTURE_PATH, config.capture_frames);
+        capture_pressed = true;
+    }
+    else capture_pressed = false;
+    if (config.capture_path && state.v.frameIndex + 1 == (config.capture_at ? config.capture_at : 1))
+        capture_start(config.capture_path, config.capture_frames);
+
+    VK_ZONE_BEGIN("input");
     INPUT();
+    if (config.golden_script) golden_frame();
+    replay_end_frame();
+    VK_ZONE_END();
 
+    VK_ZONE_BEGIN("wait_fence");
     vkWaitForFences(state.v.device, 1, &state.v.inFlightFence, VK_TRUE, UINT64_MAX);
     vkResetFences(state.v.device, 1, &state.v.inFlightFence);
-    uint32_t image_index;
-    vkAcquireNextImageKHR(state.v.device, state.v.swapchain, UINT64_MAX, state.v.imageAvailableSemaphore,
-                          VK_NULL_HANDLE, &image_index);
+    VK_ZONE_END();
+
+    // The previous frame's culling pass is done, so its counts can be read before the buffers are reused
+    state.instances_drawn = state.instances_visible = state.v.instance_count;
+    for (uint32_t i = 0; i < state.v.cull_batch_count; i++)
+        state.instances_visible -= state.v.cull_batches[i].count - state.v.indirect_commands[i].instanceCount;
+    state.v.frameIndex++;
+    texture_destroy_retired(false);
+    resolve_gpu_queries();
+    resolve_readbacks(false);
+    uint32_t image_index = 0;
+    if (!config.headless)
+    {
+        VK_ZONE_BEGIN("acquire");
+        vkAcquireNextImageKHR(state.v.device, state.v.swapchain, UINT64_MAX, state.v.imageAvailableSemaphore,
+                              VK_NULL_HANDLE, &image_index);
+        VK_ZONE_END();
+    }
 
+    VK_ZONE_BEGIN("upload");
     if (state.text_vertex_count > 0)
     {
         void *data;
@@ -1209,7 +3337,10 @@ int VK_FRAME()
         vkUnmapMemory(state.v.device, state.v.wall_buffer.memory);
         state.v.wall_buffer.vertex_count = state.wall_vertex_count;
     }
+    VK_ZONE_END();
+    capture_frame_begin();
 
+    VK_ZONE_BEGIN("record");
     vkResetCommandBuffer(state.v.commandBuffer, 0);
     const VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -1222,36 +3353,112 @@ int VK_FRAME()
     };
 
     vkBeginCommandBuffer(state.v.commandBuffer, &begin_info);
+    recording_buffer = state.v.commandBuffer;
+    begin_gpu_queries();
+
+    if (state.v.offscreen) update_render_scale();
+    const VkFramebuffer scene_framebuffer = state.v.offscreen ? state.v.sceneFramebuffer : state.v.framebuffers[image_index];
     const VkRenderPassBeginInfo render_pass_info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = state.v.renderPass,
-        .framebuffer = state.v.framebuffers[image_index],
+        .framebuffer = scene_framebuffer,
         .renderArea = {
             .offset = {0, 0},
-            .extent = state.v.swapChainExtent
+            .extent = state.v.sceneExtent
         },
         .clearValueCount = 2,
         .pClearValues = clear_values
     };
 
-    vkCmdBeginRenderPass(state.v.commandBuffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
+    vkCmdBeginRenderPass(state.v.commandBuffer, &render_pass_info,
+                         config.parallel_record ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+    update_camera();
+    atomic_store_explicit(&draw_uniform_count, 0, memory_order_relaxed);
+    state.v.instance_count = 0;
+    state.v.cull_batch_count = 0;
+    state.v.record_slice_count = 0;
+    state.v.record_segment_count = 0;
+    state.v.execute_count = 0;
+    state.v.recordFramebuffer = scene_framebuffer;
+    if (config.parallel_record) begin_segment();
+    else set_viewport(state.v.commandBuffer, state.v.sceneExtent);
     RENDER();
+    draw_queue_record(DRAW_PASS_OPAQUE);
+    if (!state.v.offscreen) draw_queue_record(DRAW_PASS_OVERLAY);
 
+    if (config.parallel_record)
+    {
+        VK_ASSERT(vkEndCommandBuffer(recording_buffer), "end segment command buffer");
+        vkCmdExecuteCommands(state.v.commandBuffer, state.v.execute_count, state.v.executeBuffers);
+        recording_buffer = state.v.commandBuffer;
+    }
     vkCmdEndRenderPass(state.v.commandBuffer);
+
+    // The HUD goes on top of the upscaled scene at native resolution
+    if (state.v.offscreen)
+    {
+        record_upscale(image_index);
+        const VkRenderPassBeginInfo hud_pass_info = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = state.v.hudRenderPass,
+            .framebuffer = state.v.framebuffers[image_index],
+            .renderArea = {
+                .offset = {0, 0},
+                .extent = state.v.swapChainExtent
+            },
+            .clearValueCount = 2,
+            .pClearValues = clear_values
+        };
+        vkCmdBeginRenderPass(state.v.commandBuffer, &hud_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+        set_viewport(state.v.commandBuffer, state.v.swapChainExtent);
+        draw_queue_record(DRAW_PASS_OVERLAY);
+        vkCmdEndRenderPass(state.v.commandBuffer);
+    }
+    capture_frame_end();
+
+    state.pipeline_binds = atomic_exchange_explicit(&command_counts.pipeline_binds, 0, memory_order_relaxed);
+    state.set_binds = atomic_exchange_explicit(&command_counts.set_binds, 0, memory_order_relaxed);
+    state.draw_calls = atomic_exchange_explicit(&command_counts.draws, 0, memory_order_relaxed);
+    if (state.v.readbackCallback) record_readback(image_index);
+    end_gpu_queries();
     vkEndCommandBuffer(state.v.commandBuffer);
+    if (state.v.cull_batch_count) record_culling();
+    VK_ZONE_END();
+
+    // Nothing to acquire or present offscreen, so no semaphores either. Culling goes first in the same
+    // submit and does not wait for the swapchain image.
+    const VkCommandBuffer command_buffers[] = {state.v.cullCommandBuffer, state.v.commandBuffer};
+    const uint32_t culling = state.v.cull_batch_count ? 1 : 0;
     const VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
+        .waitSemaphoreCount = config.headless ? 0 : 1,
         .pWaitSemaphores = &state.v.imageAvailableSemaphore,
-        .pWaitDstStageMask = &(VkPipelineStageFlags){VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
-        .commandBufferCount = 1,
-        .pCommandBuffers = &state.v.commandBuffer,
-        .signalSemaphoreCount = 1,
+        .pWaitDstStageMask = &(VkPipelineStageFlags){state.v.offscreen ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
+        .commandBufferCount = 1 + culling,
+        .pCommandBuffers = command_buffers + 1 - culling,
+        .signalSemaphoreCount = config.headless ? 0 : 1,
         .pSignalSemaphores = &state.v.renderFinishedSemaphore
     };
 
+    VK_ZONE_BEGIN("submit");
     VK_ASSERT(vkQueueSubmit(state.v.graphicsQueue, 1, &submit_info, state.v.inFlightFence), "submit draw");
+    VK_ZONE_END();
+    const double submit_time = VK_GETTIME();
+    state.cpu_frame_ms = (submit_time - current_time) * 1000.0;
+    frametime_submit(state.v.frameIndex, submit_time);
+    if (state.v.frameIndex == 1)
+    {
+        // Includes whatever RUN did between VK_START and its first VK_FRAME, level loads in practice
+        state.first_frame_ms = (submit_time - startup_begin_time) * 1000.0;
+        printf("First frame submitted %.2f ms after VK_START\n", state.first_frame_ms);
+    }
+
+    bool running = replaying;
+    if (config.golden_script && golden_done()) running = false;
+    if (config.max_frames && state.v.frameIndex >= config.max_frames) running = false;
+    if (config.max_seconds > 0.0 && current_time - state.start_time >= config.max_seconds) running = false;
+    if (config.headless) return running;
 
     const VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -1262,23 +3469,81 @@ int VK_FRAME()
         .pImageIndices = &image_index
     };
 
+    VK_ZONE_BEGIN("present");
     vkQueuePresentKHR(state.v.presentQueue, &present_info);
-    return !glfwWindowShouldClose(state.glfw.win);
+    VK_ZONE_END();
+    return running && !glfwWindowShouldClose(state.glfw.win);
 }
 
 
 void VK_END(void)
 {
+    jobs_stop();
     vkDeviceWaitIdle(state.v.device);
+    resolve_gpu_queries();
+    resolve_readbacks(true);
+    if (config.golden_script) golden_finish();
+    replay_finish();
+    capture_finish();
+    if (config.trace_path) profile_export(config.trace_path);
+
+    frametime_update();
+    const frame_times_t *times = &state.frame_times;
+    printf("Frame times over %llu frames: p50 %.2fms, p95 %.2fms, p99 %.2fms, max %.2fms, jitter %.2fms, %llu hitches\n",
+           (unsigned long long) times->count, times->cpu.p50, times->cpu.p95, times->cpu.p99, times->cpu.max,
+           times->jitter, (unsigned long long) times->hitches_total);
+    if (config.frames_csv) frametime_export(config.frames_csv);
+
+    for (uint32_t i = 0; i < READBACK_SLOTS; i++)
+    {
+        if (!state.v.readbacks[i].buffer) continue;
+        vkDestroyBuffer(state.v.device, state.v.readbacks[i].buffer, NULL);
+        vkFreeMemory(state.v.device, state.v.readbacks[i].memory, NULL);
+    }
+    for (uint32_t i = 0; i < GPU_QUERY_FRAMES; i++)
+    {
+        if (state.v.gpuQueries[i].timestamps) vkDestroyQueryPool(state.v.device, state.v.gpuQueries[i].timestamps, NULL);
+        if (state.v.gpuQueries[i].statistics) vkDestroyQueryPool(state.v.device, state.v.gpuQueries[i].statistics, NULL);
+    }
+
     vkDestroySemaphore(state.v.device, state.v.imageAvailableSemaphore, NULL);
     vkDestroySemaphore(state.v.device, state.v.renderFinishedSemaphore, NULL);
     vkDestroyFence(state.v.device, state.v.inFlightFence, NULL);
+    if (state.v.stagingBuffer)
+    {
+        vkUnmapMemory(state.v.device, state.v.stagingMemory);
+        vkDestroyBuffer(state.v.device, state.v.stagingBuffer, NULL);
+        vkFreeMemory(state.v.device, state.v.stagingMemory, NULL);
+    }
     vkDestroyBuffer(state.v.device, state.v.text_buffer.buffer, NULL);
     vkFreeMemory(state.v.device, state.v.text_buffer.memory, NULL);
     vkDestroyBuffer(state.v.device, state.v.wall_buffer.buffer, NULL);
     vkFreeMemory(state.v.device, state.v.wall_buffer.memory, NULL);
     vkDestroyBuffer(state.v.device, state.v.cube_buffer.buffer, NULL);
     vkFreeMemory(state.v.device, state.v.cube_buffer.memory, NULL);
+    vkUnmapMemory(state.v.device, state.v.instanceMemory);
+    vkDestroyBuffer(state.v.device, state.v.instanceBuffer, NULL);
+    vkFreeMemory(state.v.device, state.v.instanceMemory, NULL);
+    vkUnmapMemory(state.v.device, state.v.cameraMemory);
+    vkDestroyBuffer(state.v.device, state.v.cameraBuffer, NULL);
+    vkFreeMemory(state.v.device, state.v.cameraMemory, NULL);
+    vkUnmapMemory(state.v.device, state.v.drawUniformMemory);
+    vkDestroyBuffer(state.v.device, state.v.drawUniformBuffer, NULL);
+    vkFreeMemory(state.v.device, state.v.drawUniformMemory, NULL);
+    vkDestroyDescriptorPool(state.v.device, state.v.framePool, NULL);
+    vkDestroyDescriptorSetLayout(state.v.device, state.v.frameSetLayout, NULL);
+    if (state.v.cullSetLayout)
+    {
+        vkDestroyPipeline(state.v.device, state.v.cull_pipeline.pipeline, NULL);
+        vkDestroyPipelineLayout(state.v.device, state.v.cull_pipeline.layout, NULL);
+        vkDestroyDescriptorPool(state.v.device, state.v.cullPool, NULL);
+        vkDestroyDescriptorSetLayout(state.v.device, state.v.cullSetLayout, NULL);
+        vkDestroyBuffer(state.v.device, state.v.visibleBuffer, NULL);
+        vkFreeMemory(state.v.device, state.v.visibleMemory, NULL);
+        vkUnmapMemory(state.v.device, state.v.indirectMemory);
+        vkDestroyBuffer(state.v.device, state.v.indirectBuffer, NULL);
+        vkFreeMemory(state.v.device, state.v.indirectMemory, NULL);
+    }
     vkDestroyImageView(state.v.device, state.v.font_texture.view, NULL);
     vkDestroySampler(state.v.device, state.v.font_texture.sampler, NULL);
     vkDestroyImage(state.v.device, state.v.font_texture.image, NULL);
@@ -1288,12 +3553,51 @@ void VK_END(void)
     vkDestroyImage(state.v.device, state.v.board_texture.image, NULL);
     vkFreeMemory(state.v.device, state.v.board_texture.memory, NULL);
     vkDestroyPipeline(state.v.device, state.v.textured_pipeline.pipeline, NULL);
+    vkDestroyPipeline(state.v.device, state.v.textured_pipeline.prepass, NULL);
+    vkDestroyPipeline(state.v.device, state.v.textured_pipeline.equal, NULL);
     vkDestroyPipelineLayout(state.v.device, state.v.textured_pipeline.layout, NULL);
     vkDestroyPipeline(state.v.device, state.v.colored_pipeline.pipeline, NULL);
     vkDestroyPipelineLayout(state.v.device, state.v.colored_pipeline.layout, NULL);
+    vkDestroyPipeline(state.v.device, state.v.instanced_pipeline.pipeline, NULL);
+    vkDestroyPipeline(state.v.device, state.v.instanced_pipeline.prepass, NULL);
+    vkDestroyPipeline(state.v.device, state.v.instanced_pipeline.equal, NULL);
+    vkDestroyPipelineLayout(state.v.device, state.v.instanced_pipeline.layout, NULL);
+    if (state.v.bindless)
+    {
+        vkDestroyPipeline(state.v.device, state.v.level_pipeline.pipeline, NULL);
+        vkDestroyPipeline(state.v.device, state.v.level_pipeline.prepass, NULL);
+        vkDestroyPipeline(state.v.device, state.v.level_pipeline.equal, NULL);
+        vkDestroyPipelineLayout(state.v.device, state.v.level_pipeline.layout, NULL);
+        vkDestroyDescriptorSetLayout(state.v.device, state.v.bindlessSetLayout, NULL);
+        vkDestroyDescriptorPool(state.v.device, state.v.bindlessPool, NULL);
+    }
+    for (uint32_t i = 0; i < state.v.texture_count; i++)
+    {
+        if (state.v.textures[i].resident) texture_evict(&state.v.textures[i]);
+        free(state.v.textures[i].path);
+    }
+    texture_destroy_retired(true);
+    free(state.v.textures);
+    free(state.v.texture_lookup);
+    free(state.v.texture_retired);
+    free(state.v.bindless_free_slots);
+
     vkDestroyDescriptorSetLayout(state.v.device, state.v.textureSetLayout, NULL);
-    vkDestroyDescriptorPool(state.v.device, state.v.descriptorPool, NULL);
+    for (uint32_t i = 0; i < state.v.descriptorPoolCount; i++)
+        vkDestroyDescriptorPool(state.v.device, state.v.descriptorPools[i], NULL);
+    free(state.v.descriptorPools);
+    save_pipeline_cache();
     vkDestroyRenderPass(state.v.device, state.v.renderPass, NULL);
+    if (state.v.offscreen)
+    {
+        vkDestroyRenderPass(state.v.device, state.v.hudRenderPass, NULL);
+        vkDestroyFramebuffer(state.v.device, state.v.sceneFramebuffer, NULL);
+        vkDestroyImageView(state.v.device, state.v.sceneImageView, NULL);
+        vkDestroyImage(state.v.device, state.v.sceneImage, NULL);
+        vkFreeMemory(state.v.device, state.v.sceneMemory, NULL);
+    }
+    for (uint32_t i = 0; i < MAX_RECORD_SLICES; i++)
+        if (state.v.recordPools[i]) vkDestroyCommandPool(state.v.device, state.v.recordPools[i], NULL);
     vkDestroyCommandPool(state.v.device, state.v.commandPool, NULL);
 
     for (uint32_t i = 0; i < state.v.imageCount; ++i)
@@ -1302,6 +3606,16 @@ void VK_END(void)
         vkDestroyImageView(state.v.device, state.v.imageViews[i], NULL);
     }
 
+    if (config.headless)
+    {
+        for (uint32_t i = 0; i < state.v.imageCount; ++i)
+        {
+            vkDestroyImage(state.v.device, state.v.images[i], NULL);
+            vkFreeMemory(state.v.device, state.v.imageMemory[i], NULL);
+        }
+        free(state.v.imageMemory);
+    }
+
     free(state.v.images);
     free(state.v.imageViews);
     free(state.v.framebuffers);
@@ -1310,10 +3624,13 @@ void VK_END(void)
     vkDestroyImage(state.v.device, state.v.depthImage, NULL);
     vkFreeMemory(state.v.device, state.v.depthMemory, NULL);
 
-    vkDestroySwapchainKHR(state.v.device, state.v.swapchain, NULL);
+    if (!config.headless) vkDestroySwapchainKHR(state.v.device, state.v.swapchain, NULL);
     vkDestroyDevice(state.v.device, NULL);
-    vkDestroySurfaceKHR(state.v.instance, state.v.surface, NULL);
+    if (!config.headless) vkDestroySurfaceKHR(state.v.instance, state.v.surface, NULL);
     vkDestroyInstance(state.v.instance, NULL);
-    glfwDestroyWindow(state.glfw.win);
-    glfwTerminate();
+    if (!config.headless)
+    {
+        glfwDestroyWindow(state.glfw.win);
+        glfwTerminate();
+    }
 }
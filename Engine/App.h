@@ -8,10 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
 
 #include "level.h"
 
@@ -23,12 +25,81 @@
 void INPUT();
 void RENDER();
 void RUN();
+void VK_ARGS(int argc, char **argv);
 #define ENGINE_ENTRY_POINT \
-    int main() { \
+    int main(int argc, char **argv) { \
+        VK_ARGS(argc, argv); \
         RUN(); \
-        return 0; \
+        return state.exit_code; \
     }
 
+// Command line configuration, filled by VK_ARGS before RUN and kept across VK_START
+//   --headless     render offscreen without GLFW, window, surface or swapchain
+//   --frames N     stop after N frames
+//   --seconds S    stop after S seconds
+//   --golden FILE  run the golden-image harness over the shots in FILE (see Engine/golden.c)
+//   --golden-dir D directory holding the golden PNGs, defaults to GOLDEN_DIR
+//   --update-golden  overwrite the golden PNGs instead of comparing against them
+//   --report FILE  machine readable JSON report, defaults to GOLDEN_REPORT
+//   --trace FILE   write a Chrome trace of the CPU zones on exit, PROFILE_TRACE_KEY writes one any time
+//   --frames-csv FILE  write the frame-time history as CSV on exit, FRAME_CSV_KEY writes one any time
+//   --hitch-ms MS  frames slower than this count as hitches, defaults to HITCH_MS
+//   --record FILE  write the keys INPUT sees each frame, stepping time by REPLAY_TIMESTEP
+//   --replay FILE  feed VK_KEYDOWN and the timestep from a recording, stops at its end
+//   --capture FILE write the draw commands of --capture-frames frames from frame --capture-at on,
+//                  CAPTURE_KEY captures the next frames any time (play them back with framereplay)
+//   --lazy-init    leave the colored pipeline, cube mesh and board texture to the start of the second frame,
+//                  the cube helpers draw nothing until then
+//   --jobs N       threads for the startup task graph including the main one, 1 runs it serially,
+//                  defaults to one per core
+//   --shader-dir D read SPIR-V from D instead of the copies compiled into the engine
+//   --pack FILE    load textures, levels and shaders from a resource pack written by respack
+//   --cubes N      draw a field of N instanced cubes, up to MAX_CUBE_INSTANCES
+//   --no-cull      draw every instance instead of frustum culling them in a compute pass first
+//   --parallel-record  record the opaque draw queue and the slices RENDER hands to vk_cmd_parallel on the
+//                  job pool, each into its own secondary command buffer, and stage the cube field there
+//   --dynamic-res MS  render the scene offscreen at a scale that keeps the GPU frame under MS, upscaled
+//                  to the window under a native resolution HUD
+//   --render-scale S  scene resolution as a fraction of the window, the start point for --dynamic-res
+//   --present MODE immediate (default), mailbox, fifo or fifo-relaxed, falls back to what the surface has
+//   --fps N        cap the frame rate, sleeping most of each frame's spare time instead of spinning
+//   --no-throttle  keep full speed while the window is unfocused or minimised
+//   --depth-prepass  lay down the depth of queued opaque draws first, then shade them with an EQUAL test
+typedef struct
+{
+    bool headless;
+    uint64_t max_frames;
+    double max_seconds;
+
+    const char *golden_script;
+    const char *golden_dir;
+    bool golden_update;
+    const char *report_path;
+    const char *trace_path;
+    const char *frames_csv;
+    double hitch_ms;
+    const char *record_path;
+    const char *replay_path;
+    const char *capture_path;
+    uint64_t capture_at;
+    uint32_t capture_frames;
+    bool lazy_init;
+    uint32_t jobs;
+    const char *shader_dir;
+    const char *pack_path;
+    uint32_t cubes;
+    bool no_cull;
+    bool parallel_record;
+    double dynamic_res_ms;
+    float render_scale;
+    VkPresentModeKHR present_mode;
+    double fps_limit;
+    bool no_throttle;
+    bool depth_prepass;
+} config_t;
+
+extern config_t config;
+
 #define TITLE  "vulkan"
 #define WIDTH  1270
 #define HEIGHT 850
@@ -53,6 +124,14 @@ void RUN();
 #define CLEAR_COLOR_G 0.0f
 #define CLEAR_COLOR_B 0.0f
 #define CLEAR_COLOR_A 1.0f
+#define MAX_ANISOTROPY 16.0f
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+#define SHADER_DIR "Engine/shad" // where .spv files are read from when they are not compiled in
+
+// Frame pacing
+#define FRAME_SPIN_S 0.0015  // the last stretch before a paced frame is spun, sleeps overshoot by about this
+#define UNFOCUSED_FPS 15.0   // cap while the window is in the background
+#define MINIMISED_POLL_S 0.1 // event wait while minimised, nothing is rendered
 
 
 extern VkDescriptorSet font_descriptor_set;
@@ -68,8 +147,58 @@ typedef struct
     float position[3];
     float tex_coord[2];
     float color[4];
+    uint32_t material; // bindless texture index, only read by the level pipeline
 } vertex_t;
 
+// One cube of an instanced draw, rotation is Euler angles in radians applied X, then Y, then Z
+typedef struct {
+    vec3 position;
+    vec3 rotation;
+    vec3 scale;
+    float padding[3]; // spelled out so the layout doesn't depend on cglm aligning vec4
+    vec4 color;
+} cube_instance_t;
+
+// cull.comp reads this as 16 floats with color at 12
+_Static_assert(sizeof(cube_instance_t) == 64 && offsetof(cube_instance_t, color) == 48,
+               "cube_instance_t no longer matches the 16-float Instance in cull.comp");
+
+#define MAX_CUBE_INSTANCES (1u << 17) // per frame, across every VK_DRAWCUBES
+#define MAX_CULL_BATCHES 64           // instanced draws per frame that go through the culling pass
+#define CULL_GROUP_SIZE 64            // local_size_x of cull.comp
+#define MAX_RECORD_SLICES 32          // vk_cmd_parallel slices per frame, each has its own command pool
+#define MAX_RECORD_SEGMENTS 8         // main-thread stretches of RENDER between vk_cmd_parallel calls
+#define MAX_DRAW_UNIFORMS 16384       // vk_cmd_draw_uniforms slots in the per-frame ring
+
+// Dynamic resolution, the scale only moves while the GPU frame is outside [HEADROOM, 1] x the target
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_STEP 0.05f
+#define RENDER_SCALE_HEADROOM 0.85
+
+// Frustum culling of one instanced draw, cull.comp compacts the visible instances of [first, first + count)
+// to the start of that range in the visible buffer and counts them into indirect command batch
+typedef struct {
+    vec4 planes[6]; // view-projection frustum, inside when dot(xyz, p) + w >= 0
+    uint32_t first;
+    uint32_t count;
+    uint32_t batch;
+    float radius;   // bounding sphere of the mesh at scale 1
+} push_constants_cull_t;
+
+// Set 0 of every graphics pipeline: binding 0 holds the camera, written once a frame before RENDER,
+// binding 1 a slot of the draw uniform ring, picked by the dynamic offset vk_cmd_draw_uniforms binds
+typedef struct {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+} camera_uniforms_t;
+
+typedef struct {
+    mat4 model; // world space, clip space for the text pipeline, which ignores the camera
+    vec4 tint_color;
+    float tiling;
+} draw_uniforms_t;
+
 typedef struct
 {
     float x, y, z;
@@ -93,28 +222,178 @@ typedef struct
     VkSampler sampler;
     uint32_t width;
     uint32_t height;
+    uint32_t mip_levels;
+    VkDeviceSize size;
 } texture_t;
 
+typedef enum
+{
+    TEXTURE_DEFAULT   = 0,      // single level, nearest filtering
+    TEXTURE_MIPMAPPED = 1 << 0  // full mip chain, trilinear + anisotropic when the device supports it
+} texture_flags_t;
+
 typedef struct
 {
     VkPipeline pipeline;
     VkPipelineLayout layout;
+    VkPipeline prepass; // --depth-prepass on opaque pipelines: depth only, no fragment shader
+    VkPipeline equal;   // --depth-prepass on opaque pipelines: colour where the depth matches, no depth write
 } pipeline_t;
 
-#define MAX_TEXTURES 64
+typedef enum { PIPELINE_VARIANT_DEFAULT, PIPELINE_VARIANT_PREPASS, PIPELINE_VARIANT_EQUAL } pipeline_variant_t;
+
+// Texture registry, paths resolve once to a handle and GPU copies are evicted LRU against the budget
+#define TEXTURE_VRAM_BUDGET (256ull * 1024ull * 1024ull)
+#define TEXTURE_LOOKUP_MIN 64
+#define DESCRIPTOR_POOL_SETS 64
+#define MAX_BINDLESS_TEXTURES 1024
+#define MAX_FRAMES_IN_FLIGHT 1
+
+// Asynchronous framebuffer readback, the callback runs once the copy has landed a frame later
+#define READBACK_SLOTS 2
+typedef void (*readback_fn)(const uint8_t *rgba, uint32_t width, uint32_t height, void *user);
+
 typedef struct
 {
-    char path[256];
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void *mapped;
+    bool pending;
+    uint64_t frame;
+    readback_fn callback;
+    void *user;
+} readback_t;
+
+// GPU profiling scopes, a ring of query pools so results are picked up once ready and never waited on
+#define GPU_QUERY_FRAMES (MAX_FRAMES_IN_FLIGHT + 2)
+#define MAX_GPU_SCOPES 16
+#define GPU_STAT_COUNT 4
+typedef enum
+{
+    GPU_STAT_INPUT_VERTICES,
+    GPU_STAT_VERTEX_INVOCATIONS,
+    GPU_STAT_CLIPPING_PRIMITIVES,
+    GPU_STAT_FRAGMENT_INVOCATIONS
+} gpu_stat_t;
+
+typedef struct
+{
+    const char *name; // must outlive the frame, string literals in practice
+    uint32_t depth;
+    double ms;
+    bool has_stats; // only top-level scopes, pipeline statistics queries cannot nest
+    uint64_t stats[GPU_STAT_COUNT];
+} gpu_scope_t;
+
+typedef struct
+{
+    VkQueryPool timestamps; // frame begin/end, then begin/end per scope
+    VkQueryPool statistics; // one per top-level scope
+    bool pending;
+    uint64_t frame;
+    uint32_t scope_count;
+    uint32_t statistics_count;
+    gpu_scope_t scopes[MAX_GPU_SCOPES];
+    uint32_t statistics_query[MAX_GPU_SCOPES]; // UINT32_MAX when the scope has none
+} gpu_query_frame_t;
+
+// CPU profiling zones (Engine/profile.c), configure with -DENGINE_PROFILE=OFF to compile them out
+#ifndef ENGINE_PROFILE
+#define ENGINE_PROFILE 1
+#endif
+#define PROFILE_RING_EVENTS 16384 // per thread, power of two
+#define PROFILE_MAX_THREADS 32
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_TRACE "trace.json"
+#define PROFILE_TRACE_KEY GLFW_KEY_F9
+#define MAX_CPU_ZONES 32
+typedef struct
+{
+    const char *name; // must outlive the trace export, string literals in practice
+    uint32_t depth;
+    uint32_t calls;
+    double ms; // summed over the calls of one frame
+} cpu_zone_t;
+
+// Startup timing, one entry per VK_START phase (also a CPU zone in the trace)
+#define MAX_STARTUP_PHASES 16
+typedef struct
+{
+    const char *name;
+    double ms;
+} startup_phase_t;
+
+// Worker pool and task graph (Engine/jobs.c), used to overlap startup work across cores
+#define MAX_JOBS 64
+#define MAX_JOB_DEPS 4
+#define MAX_JOB_WORKERS 15
+typedef uint32_t job_t; // 0 is never a valid job, as a dependency it is skipped
+typedef void (*job_fn)(void *user);
+typedef void (*job_range_fn)(void *user, uint32_t index);
+
+// Frame-time history (Engine/frametime.c)
+#define FRAME_HISTORY 4096
+#define HITCH_MS 33.3
+#define FRAME_CSV "frames.csv"
+#define FRAME_CSV_KEY GLFW_KEY_F10
+typedef struct
+{
+    uint64_t frame;
+    double cpu_ms; // submit to submit
+    double gpu_ms; // negative until the timestamps resolve
+} frame_sample_t;
+
+typedef struct
+{
+    double p50;
+    double p95;
+    double p99;
+    double max;
+    uint32_t hitches; // within the history
+} frame_percentiles_t;
+
+typedef struct
+{
+    frame_sample_t samples[FRAME_HISTORY];
+    uint64_t count;
+    double last_submit;
+    uint64_t hitches_total;
+    frame_percentiles_t cpu; // recomputed once per second
+    double jitter;           // standard deviation of cpu_ms, recomputed with the percentiles
+    frame_percentiles_t gpu;
+} frame_times_t;
+
+typedef uint32_t texture_handle_t; // 0 is never a valid handle
+
+typedef struct
+{
+    char *path;
+    texture_flags_t flags;
+    uint32_t hash;
     texture_t texture;
     VkDescriptorSet descriptor_set;
-    bool loaded;
-} texture_cache_entry_t;
+    VkDescriptorPool descriptor_pool;
+    uint32_t material;
+    bool resident;
+    uint64_t last_used_frame;
+} texture_entry_t;
+
+typedef struct
+{
+    texture_t texture;
+    VkDescriptorSet descriptor_set;
+    VkDescriptorPool descriptor_pool;
+    uint32_t material;
+    uint64_t retire_frame;
+} texture_retired_t;
 
 typedef struct
 {
     VkInstance instance;
     VkPhysicalDevice physicalDevice;
     VkDevice device;
+    VkPhysicalDeviceProperties deviceProperties;
+    float maxAnisotropy;
     VkSurfaceKHR surface;
     VkSwapchainKHR swapchain;
     VkExtent2D swapChainExtent;
@@ -122,40 +401,130 @@ typedef struct
 
     uint32_t imageCount;
     VkImage *images;
+    VkDeviceMemory *imageMemory; // headless only, swapchain images are owned by the swapchain
     VkImageView *imageViews;
     VkFramebuffer *framebuffers;
 
-    VkRenderPass renderPass;
+    VkRenderPass renderPass;    // the scene, straight into the swapchain image unless offscreen
+    VkRenderPass hudRenderPass; // offscreen only, the overlay on top of the upscaled scene
+    bool offscreen;             // --dynamic-res or --render-scale, the scene goes through sceneImage
+    VkImage sceneImage;         // swapchain sized, the scene uses the sceneExtent corner of it
+    VkDeviceMemory sceneMemory;
+    VkImageView sceneImageView;
+    VkFramebuffer sceneFramebuffer;
+    VkExtent2D sceneExtent;
     VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
     VkCommandBuffer loadingCommandBuffer;
+    VkBuffer stagingBuffer;      // persistently mapped texture staging, grown to the largest upload so far
+    VkDeviceMemory stagingMemory;
+    void *stagingMapped;
+    VkDeviceSize stagingSize;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
     uint32_t graphicsFamilyIndex;
     uint32_t presentFamilyIndex;
 
+    readback_t readbacks[READBACK_SLOTS];
+    readback_fn readbackCallback; // requested for the frame being recorded
+    void *readbackUser;
+
+    uint32_t timestampValidBits;
+    bool pipelineStatistics;
+    gpu_query_frame_t gpuQueries[GPU_QUERY_FRAMES];
+    gpu_query_frame_t *gpuQueryFrame; // being recorded, NULL without timestamp support
+    uint32_t gpuScopeStack[MAX_GPU_SCOPES];
+    uint32_t gpuScopeDepth;
+    uint64_t gpuResultsFrame;
+
     VkSemaphore imageAvailableSemaphore;
     VkSemaphore renderFinishedSemaphore;
     VkFence inFlightFence;
 
-    VkDescriptorPool descriptorPool;
+    VkDescriptorPool *descriptorPools;
+    uint32_t descriptorPoolCount;
     VkDescriptorSetLayout textureSetLayout;
     texture_t font_texture;
     texture_t board_texture;
 
-    texture_cache_entry_t texture_cache[MAX_TEXTURES];
+    texture_entry_t *textures; // indexed by handle - 1
     uint32_t texture_count;
+    uint32_t texture_capacity;
+    texture_handle_t *texture_lookup; // open addressing on the path hash
+    uint32_t texture_lookup_capacity;
+    VkDeviceSize texture_resident_bytes;
+    texture_retired_t *texture_retired;
+    uint32_t texture_retired_count;
+    uint32_t texture_retired_capacity;
+    uint64_t frameIndex;
+
+    bool bindless;
+    uint32_t bindlessCapacity;
+    VkDescriptorSetLayout bindlessSetLayout;
+    VkDescriptorPool bindlessPool;
+    VkDescriptorSet bindlessSet;
+    uint32_t *bindless_free_slots;
+    uint32_t bindless_free_count;
 
     VkImage depthImage;
     VkDeviceMemory depthMemory;
     VkImageView depthImageView;
 
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm;
+    double pipelineCreateMs;
+
     pipeline_t textured_pipeline;
     pipeline_t colored_pipeline;
     pipeline_t text_pipeline;
+    pipeline_t level_pipeline;
+    pipeline_t instanced_pipeline; // cube mesh plus a cube_instance_t per instance
     mesh_buffer_t text_buffer;
     mesh_buffer_t cube_buffer;
     mesh_buffer_t wall_buffer;
+    VkBuffer instanceBuffer; // persistently mapped, refilled from the start every frame
+    VkDeviceMemory instanceMemory;
+    cube_instance_t *instances;
+    uint32_t instance_count;
+
+    // GPU culling, instanced draws become indirect draws over the instances cull.comp kept
+    bool gpuCulling;
+    pipeline_t cull_pipeline;
+    VkDescriptorSetLayout cullSetLayout;
+    VkDescriptorPool cullPool;
+    VkDescriptorSet cullSet;
+    VkBuffer visibleBuffer; // device local, the compacted instances the draws read
+    VkDeviceMemory visibleMemory;
+    VkBuffer indirectBuffer; // persistently mapped, one VkDrawIndirectCommand per batch
+    VkDeviceMemory indirectMemory;
+    VkDrawIndirectCommand *indirect_commands;
+    VkCommandBuffer cullCommandBuffer; // submitted ahead of the frame's command buffer
+    push_constants_cull_t cull_batches[MAX_CULL_BATCHES];
+    uint32_t cull_batch_count;
+
+    // Set 0 of every graphics pipeline, both buffers persistently mapped and rewritten every frame
+    VkDescriptorSetLayout frameSetLayout;
+    VkDescriptorPool framePool;
+    VkDescriptorSet frameSet;
+    VkBuffer cameraBuffer;
+    VkDeviceMemory cameraMemory;
+    camera_uniforms_t *camera;
+    VkBuffer drawUniformBuffer; // MAX_DRAW_UNIFORMS slots of draw_uniform_stride bytes
+    VkDeviceMemory drawUniformMemory;
+    uint8_t *draw_uniforms;
+    uint32_t draw_uniform_stride; // sizeof(draw_uniforms_t) rounded up to minUniformBufferOffsetAlignment
+
+    // --parallel-record, the render pass runs secondaries: segments from commandPool for what the main
+    // thread records, slices from one pool each, all executed in recording order
+    VkCommandPool recordPools[MAX_RECORD_SLICES];
+    VkCommandBuffer recordBuffers[MAX_RECORD_SLICES];
+    uint32_t record_slice_count;
+    VkCommandBuffer segmentBuffers[MAX_RECORD_SEGMENTS];
+    uint32_t record_segment_count;
+    VkCommandBuffer executeBuffers[MAX_RECORD_SLICES + MAX_RECORD_SEGMENTS];
+    uint32_t execute_count;
+    VkFramebuffer recordFramebuffer;
+    bool deferredPending; // --lazy-init left the colored pipeline, cube mesh and board texture for later
 
     const vertex_t *current_vertices;
     uint32_t current_vertex_count;
@@ -169,16 +538,40 @@ typedef struct
     glfw_t glfw;
     vulkan_t v;
     cam_t cam;
+    camera_uniforms_t camera; // what set 0 holds this frame, a copy the CPU can read cheaply
 
     int level_id;
     int level_count;
     level_t levels[MAX_LEVELS];
 
+    double start_time;
     double last_time;
     double last_frame_time;
     int frame_count;
     double fps;
+    const char *present_mode; // what the swapchain got, after any fallback
+    double pace_fps;          // frame cap in effect this frame, 0 when unpaced
     float delta_time;
+    double cpu_frame_ms; // VK_FRAME start to submit
+    double gpu_frame_ms; // from timestamps, a few frames old
+    gpu_scope_t gpu_scopes[MAX_GPU_SCOPES];
+    uint32_t gpu_scope_count;
+    cpu_zone_t cpu_zones[MAX_CPU_ZONES]; // previous frame, from the zone rings
+    uint32_t cpu_zone_count;
+    frame_times_t frame_times;
+    startup_phase_t startup_phases[MAX_STARTUP_PHASES];
+    uint32_t startup_phase_count;
+    double startup_ms;     // VK_START entry to return
+    double first_frame_ms; // VK_START entry to the first submit
+    uint32_t instances_drawn;   // previous frame, handed to vk_cmd_draw_instances
+    uint32_t instances_visible; // previous frame, left after GPU culling
+    uint32_t queued_draws;      // previous frame, packets that went through the draw queue
+    float render_scale;         // scene resolution over the window's, below 1 only when offscreen
+    uint32_t pipeline_binds;    // previous frame, every vk_cmd_* recorded
+    uint32_t set_binds;
+    uint32_t draw_calls;
+    bool capturing; // vk_cmd_* calls are being recorded
+    int exit_code;
 
     vertex_t text_vertices[MAX_TEXT_VERTICES];
     uint32_t text_vertex_count;
@@ -198,19 +591,199 @@ typedef struct
 
 extern glyph_uv_t glyphs[128];
 
-typedef struct {
-    mat4 mvp;
-    vec4 tint_color;
-    float tiling;
-} push_constants_textured_t;
-
 void VK_START(void);
 int VK_FRAME(void);
 void VK_END(void);
+double VK_GETTIME(void);
+bool VK_KEYDOWN(int key); // always false in headless mode
+void VK_READBACK(readback_fn callback, void *user); // capture the frame being recorded, headless only
+void VK_GPU_SCOPE_BEGIN(const char *name); // timestamps (and pipeline statistics) around commands in RENDER
+void VK_GPU_SCOPE_END(void);
+void vk_load_deferred(void); // creates whatever --lazy-init held back, between frames only, no-op once done
+
+#if ENGINE_PROFILE
+void profile_begin(const char *name);
+void profile_end(void);
+#define VK_ZONE_BEGIN(name) profile_begin(name)
+#define VK_ZONE_END() profile_end()
+#else
+#define VK_ZONE_BEGIN(name) ((void) 0)
+#define VK_ZONE_END() ((void) 0)
+#endif
+void profile_main_thread(void);          // VK_ARGS marks its thread as main before any job starts
+void profile_frame(void);                // folds the zones finished since the last call into state.cpu_zones
+bool profile_export(const char *path);   // Chrome trace_event JSON of everything still in the rings
+
+job_t job_add(const char *name, job_fn fn, void *user, const job_t *deps, uint32_t dep_count); // starts the pool
+void jobs_wait(job_t job); // runs ready jobs on the calling thread until this one is done
+void jobs_parallel_for(const char *name, job_range_fn fn, void *user, uint32_t count); // returns once all ran
+void jobs_stop(void);      // finishes every job and joins the workers, VK_END calls it
+
+// Resource pack (Engine/pack.c, written by respack.c), one mapped file holding textures decoded to GPU
+// formats with their mip chains plus raw level and shader files, found by the path they were packed from
+#define RESOURCE_PACK "resources.pack"
+#define PACK_MAGIC 0x4b505256u // "VRPK"
+#define PACK_VERSION 1
+#define PACK_NAME_LENGTH 120
+#define PACK_ALIGNMENT 64
+typedef enum { PACK_FILE, PACK_TEXTURE } pack_entry_type_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count; // pack_entry_t table right after the header, sorted by name
+    uint32_t reserved;
+} pack_header_t;
+
+typedef struct
+{
+    char name[PACK_NAME_LENGTH];
+    uint32_t type;
+    uint32_t format;     // VkFormat, textures only, levels stored back to back from level 0
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    uint32_t reserved;
+    uint64_t offset;     // from the start of the file, PACK_ALIGNMENT aligned
+    uint64_t size;
+} pack_entry_t;
+
+const pack_entry_t* pack_find(const char *name); // NULL without --pack or when the pack lacks it
+const void* pack_data(const pack_entry_t *entry);
+FILE* pack_fopen(const char *path); // read-only stream over the packed copy, the file itself otherwise
+
+// Compiled-in SPIR-V (Engine/shaders.c), NULL for names the build did not embed
+const uint32_t* shader_lookup(const char *name, size_t *size);
+
+void frametime_submit(uint64_t frame, double now);
+void frametime_gpu(uint64_t frame, double ms);
+void frametime_update(void);             // percentiles and hitches over the history
+bool frametime_export(const char *path); // CSV, one row per frame in the history
+
+// Input recording and replay (Engine/replay.c)
+#define REPLAY_TIMESTEP (1.0f / 60.0f)
+#define REPLAY_MAX_KEYS 32
+void replay_start(void);
+bool replay_frame(void); // before INPUT, false once a replay runs out of frames
+bool replay_keydown(int key);
+bool replay_engine_key(int key); // ESC and the F-key hotkeys, read live instead of recorded
+void replay_key(int key);
+void replay_end_frame(void); // after INPUT
+void replay_finish(void);
+
+// Draw commands, RENDER and the util.h helpers go through these so a capture sees every command
+void vk_cmd_bind_pipeline(const pipeline_t *pipeline);
+void vk_cmd_bind_pipeline_variant(const pipeline_t *pipeline, pipeline_variant_t variant);
+void vk_cmd_bind_set(const pipeline_t *pipeline, VkDescriptorSet set);
+void vk_cmd_draw_uniforms(const pipeline_t *pipeline, const draw_uniforms_t *uniforms); // copied into the ring
+void vk_set_camera(const camera_uniforms_t *camera); // VK_FRAME sets state.cam's before RENDER, replays override it
+void vk_cmd_bind_vertices(const mesh_buffer_t *buffer);
+void vk_cmd_draw(uint32_t vertex_count, uint32_t first_vertex);
+// A frame's share of the instance buffer, batch is UINT32_MAX when the range goes unculled
+typedef struct
+{
+    uint32_t first;
+    uint32_t count;
+    uint32_t batch;
+} instance_range_t;
+
+// Copies the instances to binding 1 and sets up their culling against view_proj, records nothing
+instance_range_t vk_stage_instances(uint32_t vertex_count, const cube_instance_t *instances, uint32_t count,
+                                    mat4 view_proj);
+void vk_cmd_draw_staged(uint32_t vertex_count, const instance_range_t *range); // one draw of a staged range
+// vk_stage_instances and vk_cmd_draw_staged in one, what a replayed capture draws
+void vk_cmd_draw_instances(uint32_t vertex_count, const cube_instance_t *instances, uint32_t count, mat4 view_proj);
+// Records fn(user, slice) for every slice below count in order, with --parallel-record on the job pool.
+// A slice starts with nothing bound, as does RENDER after the call. It may only use the vk_cmd_* calls
+// and util.h draw helpers with descriptor sets looked up beforehand: texture lookups and GPU scopes
+// stay on the main thread.
+typedef void (*record_fn)(void *user, uint32_t slice);
+void vk_cmd_parallel(record_fn fn, void *user, uint32_t count);
+
+// Deferred draw queue (Engine/drawqueue.c), packets are sorted by pass, pipeline, texture and depth and
+// recorded after RENDER with redundant binds left out
+#define MAX_DRAW_PACKETS 4096
+typedef enum
+{
+    DRAW_PASS_OPAQUE,  // front to back within a pipeline and texture
+    DRAW_PASS_OVERLAY, // after everything else in submission order, at native resolution
+    DRAW_PASS_COUNT
+} draw_pass_t;
+
+typedef struct
+{
+    draw_pass_t pass;
+    float depth; // distance from the camera
+    const pipeline_t *pipeline;
+    VkDescriptorSet set;
+    const mesh_buffer_t *vertices;
+    uint32_t vertex_count;
+    uint32_t first_vertex;
+    instance_range_t instances; // staged with vk_stage_instances, count 0 for a plain draw
+    draw_uniforms_t uniforms;
+} draw_packet_t;
+
+void vk_queue_draw(const draw_packet_t *packet); // copied, any thread
+void draw_queue_record(draw_pass_t pass);        // VK_FRAME, every pass in order once RENDER returns
+
+// Draw-command capture (Engine/capture.c), a flat file of records each led by a capture_record_t
+#define CAPTURE_PATH "frame.vkcap"
+#define CAPTURE_KEY GLFW_KEY_F11
+#define CAPTURE_MAGIC 0x50434b56u // "VKCP"
+#define CAPTURE_VERSION 5
+typedef enum
+{
+    CAPTURE_FRAME_BEGIN,
+    CAPTURE_FRAME_END,
+    CAPTURE_TEXTURE,        // capture_texture_t + path, a texture holding a bindless slot this frame
+    CAPTURE_VERTICES,       // capture_vertices_t + vertex_t[], what a dynamic buffer held this frame
+    CAPTURE_BIND_PIPELINE,  // capture_bind_pipeline_t
+    CAPTURE_BIND_SET,       // capture_set_t + path for registry textures
+    CAPTURE_DRAW_UNIFORMS,  // uint32_t capture_pipeline_t + draw_uniforms_t
+    CAPTURE_BIND_VERTICES,  // uint32_t capture_buffer_t
+    CAPTURE_DRAW,           // capture_draw_t
+    CAPTURE_SCOPE_BEGIN,    // name
+    CAPTURE_SCOPE_END,
+    CAPTURE_DRAW_INSTANCES, // capture_instances_t + cube_instance_t[]
+    CAPTURE_CAMERA          // camera_uniforms_t
+} capture_record_type_t;
+
+typedef enum { CAPTURE_PIPELINE_TEXTURED, CAPTURE_PIPELINE_COLORED, CAPTURE_PIPELINE_TEXT, CAPTURE_PIPELINE_LEVEL, CAPTURE_PIPELINE_INSTANCED } capture_pipeline_t;
+typedef enum { CAPTURE_BUFFER_TEXT, CAPTURE_BUFFER_WALL, CAPTURE_BUFFER_CUBE } capture_buffer_t;
+typedef enum { CAPTURE_SET_TEXTURE, CAPTURE_SET_FONT, CAPTURE_SET_BOARD, CAPTURE_SET_BINDLESS, CAPTURE_SET_NONE } capture_set_kind_t;
+
+typedef struct { uint32_t type; uint32_t size; } capture_record_t; // size of the payload, padded to 4 bytes
+typedef struct { uint32_t material; uint32_t flags; } capture_texture_t;
+typedef struct { uint32_t pipeline; uint32_t variant; } capture_bind_pipeline_t;
+typedef struct { uint32_t buffer; uint32_t count; } capture_vertices_t;
+typedef struct { uint32_t pipeline; uint32_t kind; uint32_t flags; } capture_set_t;
+typedef struct { uint32_t vertex_count; uint32_t first_vertex; } capture_draw_t;
+typedef struct { uint32_t vertex_count; uint32_t instance_count; float view_proj[16]; } capture_instances_t;
+
+void capture_start(const char *path, uint32_t frames); // from the next frame on
+void capture_frame_begin(void);
+void capture_frame_end(void);
+void capture_finish(void); // writes whatever was captured
+void capture_bind_pipeline(const pipeline_t *pipeline, pipeline_variant_t variant);
+void capture_bind_set(const pipeline_t *pipeline, VkDescriptorSet set);
+void capture_draw_uniforms(const pipeline_t *pipeline, const draw_uniforms_t *uniforms);
+void capture_camera(const camera_uniforms_t *camera);
+void capture_bind_vertices(const mesh_buffer_t *buffer);
+void capture_draw(uint32_t vertex_count, uint32_t first_vertex);
+void capture_draw_instances(uint32_t vertex_count, const cube_instance_t *instances, uint32_t count, mat4 view_proj);
+void capture_scope_begin(const char *name);
+void capture_scope_end(void);
+
+// Golden-image regression harness (Engine/golden.c), driven from VK_START/VK_FRAME/VK_END
+#define GOLDEN_DIR "Engine/res/golden"
+#define GOLDEN_REPORT "golden_report.json"
+#define GOLDEN_WARMUP_FRAMES 4
+#define GOLDEN_TIMED_FRAMES 16
+#define GOLDEN_CHANNEL_TOLERANCE 8      // per channel difference still counted as equal
+#define GOLDEN_PIXEL_TOLERANCE 0.001    // fraction of differing pixels before a shot fails
+void golden_start(const char *script);
+void golden_frame(void);
+bool golden_done(void);
+void golden_finish(void);
 
-typedef struct {
-    vec3 position;
-    vec3 rotation;
-    vec3 scale;
-    vec4 color;
-} cube_instance_t;
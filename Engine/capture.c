@@ -0,0 +1,208 @@
+#include "App.h"
+#include "util.h"
+
+// Draw-command capture
+//
+// While state.capturing is set the vk_cmd_* wrappers append every command to a record stream, and each
+// frame starts with the textures that own bindless slots plus the contents of the dynamic vertex
+// buffers. Pipelines, buffers and descriptor sets are stored as engine ids or texture paths, never as
+// Vulkan handles, so framereplay.c can rebuild them on another device and re-issue the frame.
+
+static struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    const char *path;
+    uint32_t frames_left;
+    uint32_t frame_count;
+} capture;
+
+static void capture_append(const void *data, const size_t size)
+{
+    if (capture.size + size > capture.capacity)
+    {
+        capture.capacity = capture.capacity ? capture.capacity * 2 : 1024 * 1024;
+        while (capture.size + size > capture.capacity) capture.capacity *= 2;
+        capture.data = realloc(capture.data, capture.capacity);
+        ASSERT(capture.data, "failed to grow capture buffer");
+    }
+    memcpy(capture.data + capture.size, data, size);
+    capture.size += size;
+}
+
+// A record is a fixed part followed by an optional tail (path, vertices, bytes), padded to 4 bytes
+static void capture_record(const capture_record_type_t type, const void *head, const uint32_t head_size,
+                           const void *tail, const uint32_t tail_size)
+{
+    static const uint8_t padding[4] = {0};
+    const uint32_t size = head_size + tail_size;
+    const uint32_t padded = (size + 3) & ~3u;
+
+    const capture_record_t record = {.type = type, .size = padded};
+    capture_append(&record, sizeof(record));
+    if (head_size) capture_append(head, head_size);
+    if (tail_size) capture_append(tail, tail_size);
+    if (padded != size) capture_append(padding, padded - size);
+}
+
+static uint32_t capture_pipeline_id(const pipeline_t *pipeline)
+{
+    if (pipeline == &state.v.colored_pipeline) return CAPTURE_PIPELINE_COLORED;
+    if (pipeline == &state.v.text_pipeline) return CAPTURE_PIPELINE_TEXT;
+    if (pipeline == &state.v.level_pipeline) return CAPTURE_PIPELINE_LEVEL;
+    if (pipeline == &state.v.instanced_pipeline) return CAPTURE_PIPELINE_INSTANCED;
+    return CAPTURE_PIPELINE_TEXTURED;
+}
+
+static void capture_vertices(const capture_buffer_t buffer, const vertex_t *vertices, const uint32_t count)
+{
+    const capture_vertices_t head = {.buffer = buffer, .count = count};
+    capture_record(CAPTURE_VERTICES, &head, sizeof(head), vertices, sizeof(vertex_t) * count);
+}
+
+static void capture_write_file(void)
+{
+    FILE *file = fopen(capture.path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "ERROR: Could not write capture %s\n", capture.path);
+        return;
+    }
+
+    const uint32_t header[3] = {CAPTURE_MAGIC, CAPTURE_VERSION, capture.frame_count};
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(capture.data, 1, capture.size, file);
+    fclose(file);
+
+    printf("Captured %u frames (%zu KB) to %s\n", capture.frame_count, capture.size / 1024, capture.path);
+}
+
+void capture_start(const char *path, const uint32_t frames)
+{
+    if (capture.frames_left) return;
+
+    capture.path = path;
+    capture.frames_left = frames ? frames : 1;
+    capture.frame_count = 0;
+    capture.size = 0;
+}
+
+// Called once the frame's vertex data is uploaded, so the records match what the buffers hold
+void capture_frame_begin(void)
+{
+    if (!capture.frames_left) return;
+    state.capturing = true;
+    capture_record(CAPTURE_FRAME_BEGIN, NULL, 0, NULL, 0);
+
+    if (state.v.bindless)
+    {
+        for (uint32_t i = 0; i < state.v.texture_count; i++)
+        {
+            const texture_entry_t *entry = &state.v.textures[i];
+            if (!entry->resident) continue;
+
+            const capture_texture_t head = {.material = entry->material, .flags = entry->flags};
+            capture_record(CAPTURE_TEXTURE, &head, sizeof(head), entry->path, (uint32_t) strlen(entry->path) + 1);
+        }
+    }
+
+    capture_vertices(CAPTURE_BUFFER_TEXT, state.text_vertices, state.v.text_buffer.vertex_count);
+    capture_vertices(CAPTURE_BUFFER_WALL, state.wall_vertices, state.v.wall_buffer.vertex_count);
+}
+
+void capture_frame_end(void)
+{
+    if (!state.capturing) return;
+    capture_record(CAPTURE_FRAME_END, NULL, 0, NULL, 0);
+    capture.frame_count++;
+
+    if (--capture.frames_left == 0)
+    {
+        state.capturing = false;
+        capture_write_file();
+    }
+}
+
+void capture_finish(void)
+{
+    if (capture.frame_count && capture.frames_left) capture_write_file();
+    state.capturing = false;
+    capture.frames_left = 0;
+
+    free(capture.data);
+    capture.data = NULL;
+    capture.size = capture.capacity = 0;
+}
+
+void capture_bind_pipeline(const pipeline_t *pipeline, const pipeline_variant_t variant)
+{
+    const capture_bind_pipeline_t head = {.pipeline = capture_pipeline_id(pipeline), .variant = variant};
+    capture_record(CAPTURE_BIND_PIPELINE, &head, sizeof(head), NULL, 0);
+}
+
+void capture_bind_set(const pipeline_t *pipeline, const VkDescriptorSet set)
+{
+    capture_set_t head = {.pipeline = capture_pipeline_id(pipeline), .kind = CAPTURE_SET_NONE};
+    const char *path = NULL;
+
+    if (set == VK_NULL_HANDLE) head.kind = CAPTURE_SET_NONE;
+    else if (set == font_descriptor_set) head.kind = CAPTURE_SET_FONT;
+    else if (set == board_descriptor_set) head.kind = CAPTURE_SET_BOARD;
+    else if (set == state.v.bindlessSet) head.kind = CAPTURE_SET_BINDLESS;
+    else
+    {
+        for (uint32_t i = 0; i < state.v.texture_count && !path; i++)
+        {
+            if (state.v.textures[i].descriptor_set != set) continue;
+            head.kind = CAPTURE_SET_TEXTURE;
+            head.flags = state.v.textures[i].flags;
+            path = state.v.textures[i].path;
+        }
+        if (!path) fprintf(stderr, "Warning: Captured a descriptor set the engine does not know\n");
+    }
+
+    capture_record(CAPTURE_BIND_SET, &head, sizeof(head), path, path ? (uint32_t) strlen(path) + 1 : 0);
+}
+
+void capture_draw_uniforms(const pipeline_t *pipeline, const draw_uniforms_t *uniforms)
+{
+    const uint32_t id = capture_pipeline_id(pipeline);
+    capture_record(CAPTURE_DRAW_UNIFORMS, &id, sizeof(id), uniforms, sizeof(draw_uniforms_t));
+}
+
+void capture_camera(const camera_uniforms_t *camera)
+{
+    capture_record(CAPTURE_CAMERA, camera, sizeof(camera_uniforms_t), NULL, 0);
+}
+
+void capture_bind_vertices(const mesh_buffer_t *buffer)
+{
+    const uint32_t id = buffer == &state.v.text_buffer ? CAPTURE_BUFFER_TEXT
+                      : buffer == &state.v.wall_buffer ? CAPTURE_BUFFER_WALL
+                      : CAPTURE_BUFFER_CUBE;
+    capture_record(CAPTURE_BIND_VERTICES, &id, sizeof(id), NULL, 0);
+}
+
+void capture_draw(const uint32_t vertex_count, const uint32_t first_vertex)
+{
+    const capture_draw_t head = {.vertex_count = vertex_count, .first_vertex = first_vertex};
+    capture_record(CAPTURE_DRAW, &head, sizeof(head), NULL, 0);
+}
+
+void capture_draw_instances(const uint32_t vertex_count, const cube_instance_t *instances, const uint32_t count, mat4 view_proj)
+{
+    capture_instances_t head = {.vertex_count = vertex_count, .instance_count = count};
+    memcpy(head.view_proj, view_proj, sizeof(head.view_proj));
+    capture_record(CAPTURE_DRAW_INSTANCES, &head, sizeof(head), instances, sizeof(cube_instance_t) * count);
+}
+
+void capture_scope_begin(const char *name)
+{
+    capture_record(CAPTURE_SCOPE_BEGIN, NULL, 0, name, (uint32_t) strlen(name) + 1);
+}
+
+void capture_scope_end(void)
+{
+    capture_record(CAPTURE_SCOPE_END, NULL, 0, NULL, 0);
+}
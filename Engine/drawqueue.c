@@ -0,0 +1,247 @@
+#include "App.h"
+#include "util.h"
+
+#include <pthread.h>
+
+// Deferred draw queue
+//
+// vk_queue_draw copies a packet and derives its 64-bit sort key, high bits first:
+//
+//   pass (4) | pipeline (8) | descriptor set (20) | depth (32)
+//
+// Overlay packets use pass (4) | submission index (60) instead, so the HUD layers in the order it was
+// drawn whatever its pipelines and textures.
+//
+// VK_FRAME radix sorts the frame's keys once RENDER returns and records each pass's packets in that
+// order into its render pass, skipping any bind that matches what is already bound. Opaque packets of
+// one pipeline and texture come out front to back. The sort is stable, so equal keys keep submission
+// order. Pipelines get a slot the first time they are queued; sets are hashed. A hash collision only
+// costs grouping, since the elision compares the real handles. Instanced packets carry a range staged
+// when they were queued, so the depth pre-pass draws them twice without copying or culling twice.
+
+#define DRAW_KEY_PASS_SHIFT 60
+#define DRAW_KEY_PIPELINE_SHIFT 52
+#define DRAW_KEY_SET_SHIFT 32
+#define DRAW_KEY_SET_MASK 0xfffffu
+#define DRAW_PIPELINE_SLOTS 255
+#define DRAW_RECORD_CHUNK 64                      // opaque packets per slice under --parallel-record
+#define DRAW_RECORD_SLICES (MAX_RECORD_SLICES / 2) // the depth pre-pass records the opaque pass twice
+
+static struct
+{
+    pthread_mutex_t lock; // slices of vk_cmd_parallel queue at the same time
+    draw_packet_t packets[MAX_DRAW_PACKETS];
+    uint64_t keys[MAX_DRAW_PACKETS];
+    uint32_t order[MAX_DRAW_PACKETS];
+    uint32_t scratch[MAX_DRAW_PACKETS];
+    uint32_t count;
+    const uint32_t *sorted; // set by the frame's first draw_queue_record
+    uint32_t next;          // first sorted packet not recorded yet
+    bool overflowed; // warned once
+    const pipeline_t *pipelines[DRAW_PIPELINE_SLOTS];
+    uint32_t pipeline_count;
+} queue = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Expects queue.lock to be held
+static uint64_t pipeline_slot(const pipeline_t *pipeline)
+{
+    for (uint32_t i = 0; i < queue.pipeline_count; i++)
+        if (queue.pipelines[i] == pipeline) return i;
+    if (queue.pipeline_count == DRAW_PIPELINE_SLOTS) return DRAW_PIPELINE_SLOTS;
+    queue.pipelines[queue.pipeline_count] = pipeline;
+    return queue.pipeline_count++;
+}
+
+static uint64_t set_hash(const VkDescriptorSet set)
+{
+    uint64_t bits = (uint64_t) (uintptr_t) set;
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return bits & DRAW_KEY_SET_MASK;
+}
+
+// Non-negative floats order the same as their bit patterns
+static uint64_t depth_bits(const float depth)
+{
+    const float clamped = depth > 0.0f ? depth : 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &clamped, sizeof(bits));
+    return bits;
+}
+
+void vk_queue_draw(const draw_packet_t *packet)
+{
+    if (packet->vertex_count == 0) return;
+
+    pthread_mutex_lock(&queue.lock);
+    if (queue.count == MAX_DRAW_PACKETS)
+    {
+        if (!queue.overflowed) fprintf(stderr, "Warning: More than %d queued draws in a frame, dropping the rest\n", MAX_DRAW_PACKETS);
+        queue.overflowed = true;
+        pthread_mutex_unlock(&queue.lock);
+        return;
+    }
+
+    const uint32_t index = queue.count++;
+    queue.packets[index] = *packet;
+    if (packet->pass == DRAW_PASS_OVERLAY)
+        queue.keys[index] = (uint64_t) packet->pass << DRAW_KEY_PASS_SHIFT | index;
+    else
+        queue.keys[index] = (uint64_t) packet->pass << DRAW_KEY_PASS_SHIFT |
+                            pipeline_slot(packet->pipeline) << DRAW_KEY_PIPELINE_SHIFT |
+                            set_hash(packet->set) << DRAW_KEY_SET_SHIFT |
+                            (packet->pass == DRAW_PASS_OPAQUE ? depth_bits(packet->depth) : 0);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+// LSD radix sort of the packet indices, a byte every key shares is skipped without a scatter
+static const uint32_t* sort_packets(void)
+{
+    uint32_t *src = queue.order, *dst = queue.scratch;
+    for (uint32_t i = 0; i < queue.count; i++) src[i] = i;
+
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t offsets[256] = {0};
+        for (uint32_t i = 0; i < queue.count; i++) offsets[(queue.keys[src[i]] >> shift) & 0xff]++;
+        if (offsets[(queue.keys[src[0]] >> shift) & 0xff] == queue.count) continue;
+
+        for (uint32_t b = 0, sum = 0; b < 256; b++)
+        {
+            const uint32_t n = offsets[b];
+            offsets[b] = sum;
+            sum += n;
+        }
+        for (uint32_t i = 0; i < queue.count; i++) dst[offsets[(queue.keys[src[i]] >> shift) & 0xff]++] = src[i];
+
+        uint32_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+static uint32_t packet_pass(const uint32_t index)
+{
+    return (uint32_t) (queue.keys[index] >> DRAW_KEY_PASS_SHIFT);
+}
+
+// Records sorted packets [begin, end) with one pipeline variant. A new render pass starts with nothing
+// bound. Set 0 is compatible across every pipeline layout, so the draw uniforms survive pipeline
+// switches; the texture set only stays valid within the same layout and the depth pre-pass skips it.
+static void record_packets(const uint32_t begin, const uint32_t end, const pipeline_variant_t variant)
+{
+    const pipeline_t *pipeline = NULL;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    const mesh_buffer_t *vertices = NULL;
+    const draw_uniforms_t *uniforms = NULL;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const draw_packet_t *packet = &queue.packets[queue.sorted[i]];
+        if (packet->pipeline != pipeline)
+        {
+            vk_cmd_bind_pipeline_variant(packet->pipeline, variant);
+            if (packet->pipeline->layout != layout) set = VK_NULL_HANDLE;
+            pipeline = packet->pipeline;
+            layout = pipeline->layout;
+        }
+        if (packet->set != set && variant != PIPELINE_VARIANT_PREPASS)
+        {
+            vk_cmd_bind_set(pipeline, packet->set);
+            set = packet->set;
+        }
+        if (!uniforms || memcmp(uniforms, &packet->uniforms, sizeof(draw_uniforms_t)) != 0)
+        {
+            vk_cmd_draw_uniforms(pipeline, &packet->uniforms);
+            uniforms = &packet->uniforms;
+        }
+        if (packet->vertices != vertices)
+        {
+            vk_cmd_bind_vertices(packet->vertices);
+            vertices = packet->vertices;
+        }
+        if (packet->instances.count) vk_cmd_draw_staged(packet->vertex_count, &packet->instances);
+        else vk_cmd_draw(packet->vertex_count, packet->first_vertex);
+    }
+}
+
+typedef struct
+{
+    uint32_t begin;
+    uint32_t end;
+    uint32_t chunk;
+    pipeline_variant_t variant;
+} record_chunks_t;
+
+static void record_chunk(void *user, const uint32_t slice)
+{
+    const record_chunks_t *chunks = user;
+    const uint32_t begin = chunks->begin + slice * chunks->chunk;
+    const uint32_t end = chunks->end - begin > chunks->chunk ? begin + chunks->chunk : chunks->end;
+    record_packets(begin, end, chunks->variant);
+}
+
+// --parallel-record splits the opaque packets into chunks recorded on the job pool. Each chunk starts
+// with nothing bound, so it costs at most a few binds the serial recording would have skipped.
+static void record_opaque(const uint32_t begin, const uint32_t end, const pipeline_variant_t variant)
+{
+    if (!config.parallel_record)
+    {
+        record_packets(begin, end, variant);
+        return;
+    }
+
+    uint32_t slices = (end - begin + DRAW_RECORD_CHUNK - 1) / DRAW_RECORD_CHUNK;
+    if (slices > DRAW_RECORD_SLICES) slices = DRAW_RECORD_SLICES;
+    const record_chunks_t chunks = {.begin = begin, .end = end, .chunk = (end - begin + slices - 1) / slices, .variant = variant};
+    vk_cmd_parallel(record_chunk, (void *) &chunks, slices);
+}
+
+void draw_queue_record(const draw_pass_t pass)
+{
+    static const char *pass_names[DRAW_PASS_COUNT] = {"opaque", "overlay"};
+
+    VK_ZONE_BEGIN("draw_queue");
+    if (!queue.sorted)
+    {
+        state.queued_draws = queue.count;
+        queue.sorted = queue.count ? sort_packets() : queue.order;
+        queue.next = 0;
+    }
+
+    // Passes come out in key order, so everything before this one was recorded or skipped already
+    while (queue.next < queue.count && packet_pass(queue.sorted[queue.next]) < pass) queue.next++;
+    uint32_t end = queue.next;
+    while (end < queue.count && packet_pass(queue.sorted[end]) == pass) end++;
+
+    // --depth-prepass draws the opaque packets twice, depth first, then colour for only the nearest
+    // fragment of each pixel. The scopes' fragment invocation counts show what the pre-pass saved.
+    if (end > queue.next && pass == DRAW_PASS_OPAQUE && config.depth_prepass)
+    {
+        VK_GPU_SCOPE_BEGIN("depth_prepass");
+        record_opaque(queue.next, end, PIPELINE_VARIANT_PREPASS);
+        VK_GPU_SCOPE_END();
+        VK_GPU_SCOPE_BEGIN(pass_names[pass]);
+        record_opaque(queue.next, end, PIPELINE_VARIANT_EQUAL);
+        VK_GPU_SCOPE_END();
+    }
+    else if (end > queue.next)
+    {
+        // The overlay may go to the HUD render pass, which runs its commands inline
+        VK_GPU_SCOPE_BEGIN(pass_names[pass]);
+        if (pass == DRAW_PASS_OPAQUE) record_opaque(queue.next, end, PIPELINE_VARIANT_DEFAULT);
+        else record_packets(queue.next, end, PIPELINE_VARIANT_DEFAULT);
+        VK_GPU_SCOPE_END();
+    }
+
+    queue.next = end;
+    if (pass == DRAW_PASS_COUNT - 1)
+    {
+        queue.count = 0;
+        queue.sorted = NULL;
+    }
+    VK_ZONE_END();
+}
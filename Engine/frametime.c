@@ -0,0 +1,113 @@
+#include "App.h"
+
+// Frame-time history
+//
+// Every submit records the time since the previous submit into a ring of FRAME_HISTORY samples, the
+// GPU time of the same frame is filled in when its timestamps resolve a few frames later. Percentiles
+// are recomputed from the ring once per second together with state.fps, and so is the jitter, how far
+// the submit intervals stray from their mean, which is what --fps pacing is judged by.
+
+static double frametime_threshold(void)
+{
+    return config.hitch_ms > 0.0 ? config.hitch_ms : HITCH_MS;
+}
+
+void frametime_submit(const uint64_t frame, const double now)
+{
+    frame_times_t *times = &state.frame_times;
+    if (times->last_submit > 0.0)
+    {
+        const double ms = (now - times->last_submit) * 1000.0;
+        times->samples[times->count % FRAME_HISTORY] = (frame_sample_t){.frame = frame, .cpu_ms = ms, .gpu_ms = -1.0};
+        times->count++;
+        if (ms > frametime_threshold()) times->hitches_total++;
+    }
+    times->last_submit = now;
+}
+
+void frametime_gpu(const uint64_t frame, const double ms)
+{
+    frame_times_t *times = &state.frame_times;
+    if (!times->count) return;
+
+    // Walk back from the newest sample, the frame is recent unless it was dropped from the ring
+    const uint64_t newest = times->count - 1;
+    for (uint64_t i = 0; i <= newest && i < FRAME_HISTORY; i++)
+    {
+        frame_sample_t *sample = &times->samples[(newest - i) % FRAME_HISTORY];
+        if (sample->frame == frame)
+        {
+            sample->gpu_ms = ms;
+            return;
+        }
+        if (sample->frame < frame) return;
+    }
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank on a sorted copy
+static frame_percentiles_t percentiles(double *values, const uint32_t count)
+{
+    frame_percentiles_t result = {0};
+    if (!count) return result;
+
+    qsort(values, count, sizeof(double), compare_ms);
+    result.p50 = values[(count - 1) * 50 / 100];
+    result.p95 = values[(count - 1) * 95 / 100];
+    result.p99 = values[(count - 1) * 99 / 100];
+    result.max = values[count - 1];
+
+    const double threshold = frametime_threshold();
+    for (uint32_t i = count; i > 0 && values[i - 1] > threshold; i--) result.hitches++;
+    return result;
+}
+
+void frametime_update(void)
+{
+    frame_times_t *times = &state.frame_times;
+    const uint32_t count = times->count < FRAME_HISTORY ? (uint32_t) times->count : FRAME_HISTORY;
+
+    static double values[FRAME_HISTORY];
+    for (uint32_t i = 0; i < count; i++) values[i] = times->samples[i].cpu_ms;
+    times->cpu = percentiles(values, count);
+
+    double sum = 0.0, sum_squares = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum += times->samples[i].cpu_ms;
+        sum_squares += times->samples[i].cpu_ms * times->samples[i].cpu_ms;
+    }
+    const double mean = count ? sum / count : 0.0;
+    times->jitter = count ? sqrt(fmax(sum_squares / count - mean * mean, 0.0)) : 0.0;
+
+    uint32_t gpu_count = 0;
+    for (uint32_t i = 0; i < count; i++)
+        if (times->samples[i].gpu_ms >= 0.0) values[gpu_count++] = times->samples[i].gpu_ms;
+    times->gpu = percentiles(values, gpu_count);
+}
+
+bool frametime_export(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+
+    const frame_times_t *times = &state.frame_times;
+    const uint64_t first = times->count > FRAME_HISTORY ? times->count - FRAME_HISTORY : 0;
+
+    fprintf(file, "frame,cpu_ms,gpu_ms\n");
+    for (uint64_t i = first; i < times->count; i++)
+    {
+        const frame_sample_t *sample = &times->samples[i % FRAME_HISTORY];
+        if (sample->gpu_ms >= 0.0) fprintf(file, "%llu,%.4f,%.4f\n", (unsigned long long) sample->frame, sample->cpu_ms, sample->gpu_ms);
+        else fprintf(file, "%llu,%.4f,\n", (unsigned long long) sample->frame, sample->cpu_ms);
+    }
+    fclose(file);
+
+    printf("Frame times written to %s\n", path);
+    return true;
+}
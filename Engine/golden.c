@@ -0,0 +1,384 @@
+#include "App.h"
+#include "util.h"
+
+#include "ext/stb_image.h"
+
+// Golden-image regression and timing harness
+//
+// The script lists one shot per line:  name level x y z yaw pitch
+// Every shot is rendered for GOLDEN_WARMUP_FRAMES, then timed for GOLDEN_TIMED_FRAMES, and the last
+// timed frame is read back and compared against <golden dir>/<name>.png. A missing golden fails its
+// shot, only --update-golden writes them.
+
+#define MAX_GOLDEN_SHOTS 64
+
+typedef struct
+{
+    char name[64];
+    int level;
+    cam_t cam;
+
+    double cpu_ms[GOLDEN_TIMED_FRAMES];
+    double gpu_ms[GOLDEN_TIMED_FRAMES];
+    gpu_scope_t scopes[MAX_GPU_SCOPES]; // ms summed over the timed frames, statistics from the last one
+    uint32_t scope_frames[MAX_GPU_SCOPES];
+    uint32_t scope_count;
+
+    bool compared;
+    bool passed;
+    bool created;
+    uint32_t diff_pixels;
+    int max_diff;
+} golden_shot_t;
+
+typedef enum { GOLDEN_WARMUP, GOLDEN_TIMING, GOLDEN_WAIT_READBACK, GOLDEN_DONE } golden_phase_t;
+
+static struct
+{
+    golden_shot_t shots[MAX_GOLDEN_SHOTS];
+    uint32_t shot_count;
+    uint32_t current;
+    golden_phase_t phase;
+    uint32_t phase_frame;
+} golden;
+
+static uint32_t png_crc_table[256];
+
+static uint32_t png_crc(const uint8_t *data, const size_t len, uint32_t crc)
+{
+    if (!png_crc_table[1])
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            png_crc_table[n] = c;
+        }
+    }
+
+    for (size_t i = 0; i < len; i++) crc = png_crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void png_put_u32(uint8_t *out, const uint32_t v)
+{
+    out[0] = (uint8_t) (v >> 24);
+    out[1] = (uint8_t) (v >> 16);
+    out[2] = (uint8_t) (v >> 8);
+    out[3] = (uint8_t) v;
+}
+
+static void png_write_chunk(FILE *file, const char *type, const uint8_t *data, const uint32_t len)
+{
+    uint8_t header[8];
+    png_put_u32(header, len);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = png_crc(header + 4, 4, 0xffffffffu);
+    crc = png_crc(data, len, crc) ^ 0xffffffffu;
+
+    uint8_t footer[4];
+    png_put_u32(footer, crc);
+
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, len, file);
+    fwrite(footer, 1, 4, file);
+}
+
+// RGBA8 PNG with stored (uncompressed) deflate blocks, big but needs no zlib
+static bool write_png(const char *path, const uint8_t *rgba, const uint32_t width, const uint32_t height)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+
+    const size_t row = (size_t) width * 4 + 1;
+    const size_t raw_size = row * height;
+    const size_t block_count = (raw_size + 65534) / 65535;
+    const size_t zlib_size = 2 + raw_size + block_count * 5 + 4;
+
+    uint8_t *zlib = malloc(zlib_size);
+    ASSERT(zlib, "failed to allocate png buffer");
+
+    size_t pos = 0;
+    zlib[pos++] = 0x78;
+    zlib[pos++] = 0x01;
+
+    uint32_t a = 1, b = 0;
+    size_t raw_pos = 0;
+    size_t block_left = 0;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < row; x++, raw_pos++)
+        {
+            if (!block_left)
+            {
+                const size_t remaining = raw_size - raw_pos;
+                const uint16_t len = (uint16_t) (remaining > 65535 ? 65535 : remaining);
+                const uint16_t nlen = (uint16_t) ~len;
+                zlib[pos++] = remaining <= 65535 ? 1 : 0;
+                zlib[pos++] = (uint8_t) len;
+                zlib[pos++] = (uint8_t) (len >> 8);
+                zlib[pos++] = (uint8_t) nlen;
+                zlib[pos++] = (uint8_t) (nlen >> 8);
+                block_left = len;
+            }
+
+            // Filter type 0 in front of every row
+            const uint8_t byte = x == 0 ? 0 : rgba[(size_t) y * width * 4 + x - 1];
+            zlib[pos++] = byte;
+            block_left--;
+
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    png_put_u32(zlib + pos, (b << 16) | a);
+    pos += 4;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    uint8_t ihdr[13];
+    png_put_u32(ihdr, width);
+    png_put_u32(ihdr + 4, height);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 6;  // RGBA
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+    png_write_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+    png_write_chunk(file, "IDAT", zlib, (uint32_t) pos);
+    png_write_chunk(file, "IEND", NULL, 0);
+
+    free(zlib);
+    fclose(file);
+    return true;
+}
+
+static const char* golden_dir(void)
+{
+    return config.golden_dir ? config.golden_dir : GOLDEN_DIR;
+}
+
+static void golden_compare(const uint8_t *rgba, const uint32_t width, const uint32_t height, void *user)
+{
+    golden_shot_t *shot = user;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.png", golden_dir(), shot->name);
+
+    int golden_width = 0, golden_height = 0, golden_channels = 0;
+    stbi_uc *expected = config.golden_update ? NULL : stbi_load(path, &golden_width, &golden_height, &golden_channels, STBI_rgb_alpha);
+
+    shot->compared = true;
+    if (config.golden_update)
+    {
+        shot->created = write_png(path, rgba, width, height);
+        shot->passed = shot->created;
+        if (!shot->created) fprintf(stderr, "ERROR: Could not write golden image %s\n", path);
+        return;
+    }
+
+    // A missing reference fails, otherwise every fresh checkout would pass against its own output
+    if (!expected)
+    {
+        fprintf(stderr, "ERROR: Golden %s is missing, write it with --update-golden\n", path);
+        shot->passed = false;
+        return;
+    }
+
+    if ((uint32_t) golden_width != width || (uint32_t) golden_height != height)
+    {
+        fprintf(stderr, "ERROR: Golden %s is %dx%d, frame is %ux%u\n", path, golden_width, golden_height, width, height);
+        shot->passed = false;
+        stbi_image_free(expected);
+        return;
+    }
+
+    const size_t pixel_count = (size_t) width * height;
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        int pixel_diff = 0;
+        for (int c = 0; c < 4; c++)
+        {
+            const int d = abs((int) rgba[i * 4 + c] - (int) expected[i * 4 + c]);
+            if (d > pixel_diff) pixel_diff = d;
+        }
+        if (pixel_diff > shot->max_diff) shot->max_diff = pixel_diff;
+        if (pixel_diff > GOLDEN_CHANNEL_TOLERANCE) shot->diff_pixels++;
+    }
+    stbi_image_free(expected);
+
+    shot->passed = (double) shot->diff_pixels <= GOLDEN_PIXEL_TOLERANCE * (double) pixel_count;
+    if (!shot->passed)
+    {
+        snprintf(path, sizeof(path), "%s/%s.actual.png", golden_dir(), shot->name);
+        write_png(path, rgba, width, height);
+    }
+}
+
+void golden_start(const char *script)
+{
+    ASSERT(config.headless, "the golden harness needs --headless");
+    memset(&golden, 0, sizeof(golden));
+
+    FILE *file = fopen(script, "r");
+    ASSERT(file, "could not open golden script");
+
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '\n' || line[0] == '#' || line[0] == '\0') continue;
+        if (golden.shot_count >= MAX_GOLDEN_SHOTS)
+        {
+            fprintf(stderr, "Warning: Golden script has more than %d shots, ignoring the rest\n", MAX_GOLDEN_SHOTS);
+            break;
+        }
+
+        golden_shot_t *shot = &golden.shots[golden.shot_count];
+        if (sscanf(line, "%63s %d %f %f %f %f %f", shot->name, &shot->level,
+                   &shot->cam.x, &shot->cam.y, &shot->cam.z, &shot->cam.yaw, &shot->cam.pitch) == 7)
+            golden.shot_count++;
+    }
+    fclose(file);
+
+    golden.phase = golden.shot_count ? GOLDEN_WARMUP : GOLDEN_DONE;
+    printf("Golden: %u shots from %s\n", golden.shot_count, script);
+}
+
+static void golden_add_scopes(golden_shot_t *shot)
+{
+    for (uint32_t i = 0; i < state.gpu_scope_count; i++)
+    {
+        const gpu_scope_t *scope = &state.gpu_scopes[i];
+        uint32_t s = 0;
+        while (s < shot->scope_count && strcmp(shot->scopes[s].name, scope->name) != 0) s++;
+        if (s == MAX_GPU_SCOPES) continue;
+        if (s == shot->scope_count)
+        {
+            shot->scopes[s] = (gpu_scope_t){.name = scope->name, .depth = scope->depth};
+            shot->scope_count++;
+        }
+
+        shot->scopes[s].ms += scope->ms;
+        shot->scopes[s].has_stats = scope->has_stats;
+        memcpy(shot->scopes[s].stats, scope->stats, sizeof(scope->stats));
+        shot->scope_frames[s]++;
+    }
+}
+
+void golden_frame(void)
+{
+    if (golden.phase == GOLDEN_DONE) return;
+
+    golden_shot_t *shot = &golden.shots[golden.current];
+    ASSERT(shot->level >= 0 && shot->level < state.level_count, "golden shot references a level that is not loaded");
+
+    // Pin the camera and keep the HUD out of the image, it shows live timings
+    state.level_id = shot->level;
+    state.cam = shot->cam;
+    state.text_vertex_count = 0;
+
+    switch (golden.phase)
+    {
+        case GOLDEN_WARMUP:
+            if (++golden.phase_frame >= GOLDEN_WARMUP_FRAMES)
+            {
+                golden.phase = GOLDEN_TIMING;
+                golden.phase_frame = 0;
+            }
+            break;
+
+        case GOLDEN_TIMING:
+            // Timings lag one frame behind, the camera is fixed so they still belong to this shot
+            shot->cpu_ms[golden.phase_frame] = state.cpu_frame_ms;
+            shot->gpu_ms[golden.phase_frame] = state.gpu_frame_ms;
+            golden_add_scopes(shot);
+            if (++golden.phase_frame >= GOLDEN_TIMED_FRAMES)
+            {
+                VK_READBACK(golden_compare, shot);
+                golden.phase = GOLDEN_WAIT_READBACK;
+            }
+            break;
+
+        case GOLDEN_WAIT_READBACK:
+            if (!shot->compared) break;
+            printf("Golden %s: %s\n", shot->name, shot->created ? "created" : shot->passed ? "passed" : "FAILED");
+            golden.current++;
+            golden.phase = golden.current < golden.shot_count ? GOLDEN_WARMUP : GOLDEN_DONE;
+            golden.phase_frame = 0;
+            break;
+
+        case GOLDEN_DONE:
+            break;
+    }
+}
+
+bool golden_done(void)
+{
+    return golden.phase == GOLDEN_DONE;
+}
+
+static void write_timings(FILE *file, const char *key, const double *values)
+{
+    double sum = 0.0, min = values[0], max = values[0];
+    for (int i = 0; i < GOLDEN_TIMED_FRAMES; i++)
+    {
+        sum += values[i];
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+
+    fprintf(file, "\"%s\": {\"avg\": %.4f, \"min\": %.4f, \"max\": %.4f, \"frames\": [", key, sum / GOLDEN_TIMED_FRAMES, min, max);
+    for (int i = 0; i < GOLDEN_TIMED_FRAMES; i++)
+        fprintf(file, "%s%.4f", i ? ", " : "", values[i]);
+    fprintf(file, "]}");
+}
+
+static void write_scopes(FILE *file, const golden_shot_t *shot)
+{
+    fprintf(file, ", \"gpu_scopes\": [");
+    for (uint32_t s = 0; s < shot->scope_count; s++)
+    {
+        const gpu_scope_t *scope = &shot->scopes[s];
+        fprintf(file, "%s{\"name\": \"%s\", \"depth\": %u, \"avg_ms\": %.4f", s ? ", " : "",
+                scope->name, scope->depth, scope->ms / shot->scope_frames[s]);
+        if (scope->has_stats)
+            fprintf(file, ", \"input_vertices\": %llu, \"vertex_invocations\": %llu, \"clipping_primitives\": %llu, \"fragment_invocations\": %llu",
+                    (unsigned long long) scope->stats[GPU_STAT_INPUT_VERTICES],
+                    (unsigned long long) scope->stats[GPU_STAT_VERTEX_INVOCATIONS],
+                    (unsigned long long) scope->stats[GPU_STAT_CLIPPING_PRIMITIVES],
+                    (unsigned long long) scope->stats[GPU_STAT_FRAGMENT_INVOCATIONS]);
+        fprintf(file, "}");
+    }
+    fprintf(file, "]");
+}
+
+void golden_finish(void)
+{
+    const char *report_path = config.report_path ? config.report_path : GOLDEN_REPORT;
+    FILE *file = fopen(report_path, "w");
+    ASSERT(file, "could not write golden report");
+
+    uint32_t passed = 0, failed = 0;
+    fprintf(file, "{\n  \"shots\": [\n");
+    for (uint32_t i = 0; i < golden.shot_count; i++)
+    {
+        const golden_shot_t *shot = &golden.shots[i];
+        const char *status = !shot->compared ? "skipped" : shot->created ? "created" : shot->passed ? "passed" : "failed";
+        if (shot->compared && shot->passed) passed++;
+        else failed++;
+
+        fprintf(file, "    {\"name\": \"%s\", \"level\": %d, \"status\": \"%s\", \"diff_pixels\": %u, \"max_diff\": %d, ",
+                shot->name, shot->level, status, shot->diff_pixels, shot->max_diff);
+        write_timings(file, "cpu_ms", shot->cpu_ms);
+        fprintf(file, ", ");
+        write_timings(file, "gpu_ms", shot->gpu_ms);
+        write_scopes(file, shot);
+        fprintf(file, "}%s\n", i + 1 < golden.shot_count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"passed\": %u,\n  \"failed\": %u\n}\n", passed, failed);
+    fclose(file);
+
+    printf("Golden: %u passed, %u failed, report written to %s\n", passed, failed, report_path);
+    if (failed) state.exit_code = 1;
+}
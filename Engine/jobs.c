@@ -0,0 +1,224 @@
+#include "App.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// Worker pool and task graph
+//
+// A job runs once every job it depends on has finished, on whichever worker (or waiting thread) picks
+// it up first. Dependencies can only point at jobs added earlier, so the graph can never cycle. The
+// table is fixed and guarded by one mutex: startup hands out a few dozen coarse tasks, so a linear scan
+// for the next ready one costs nothing next to the file reads, decodes and pipeline compiles it runs.
+// Jobs must not add or wait on other jobs.
+//
+// jobs_parallel_for spreads one function over a range of indices instead, for per-frame work that would
+// otherwise fill the table: the caller and every idle worker pull indices until the range runs out.
+
+typedef enum
+{
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE
+} job_status_t;
+
+typedef struct
+{
+    const char *name;
+    job_fn fn;
+    void *user;
+    job_t deps[MAX_JOB_DEPS];
+    uint32_t dep_count;
+    job_status_t status;
+} job_entry_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // a job was added or finished, or the pool is stopping
+    pthread_t workers[MAX_JOB_WORKERS];
+    uint32_t worker_count;
+    bool started;
+    bool stopping;
+    job_entry_t entries[MAX_JOBS];
+    uint32_t count;
+    uint32_t unfinished;
+    const char *range_name; // the jobs_parallel_for in flight, if range_fn is set
+    job_range_fn range_fn;
+    void *range_user;
+    uint32_t range_next;
+    uint32_t range_count;
+    uint32_t range_done;
+} jobs = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+
+// Everything below expects jobs.lock to be held
+static bool job_ready(const job_entry_t *entry)
+{
+    if (entry->status != JOB_PENDING) return false;
+    for (uint32_t i = 0; i < entry->dep_count; i++)
+        if (jobs.entries[entry->deps[i] - 1].status != JOB_DONE) return false;
+    return true;
+}
+
+static job_entry_t* job_next(void)
+{
+    for (uint32_t i = 0; i < jobs.count; i++)
+        if (job_ready(&jobs.entries[i])) return &jobs.entries[i];
+    return NULL;
+}
+
+// The lock is dropped while the job itself runs
+static void job_run(job_entry_t *entry)
+{
+    entry->status = JOB_RUNNING;
+    pthread_mutex_unlock(&jobs.lock);
+
+    VK_ZONE_BEGIN(entry->name);
+    entry->fn(entry->user);
+    VK_ZONE_END();
+
+    pthread_mutex_lock(&jobs.lock);
+    entry->status = JOB_DONE;
+    jobs.unfinished--;
+    pthread_cond_broadcast(&jobs.changed);
+}
+
+// Runs the next index of the range in flight, false when none is left to hand out
+static bool range_run(void)
+{
+    if (!jobs.range_fn || jobs.range_next >= jobs.range_count) return false;
+
+    const char *name = jobs.range_name;
+    const job_range_fn fn = jobs.range_fn;
+    void *user = jobs.range_user;
+    const uint32_t index = jobs.range_next++;
+    pthread_mutex_unlock(&jobs.lock);
+
+    VK_ZONE_BEGIN(name);
+    fn(user, index);
+    VK_ZONE_END();
+
+    pthread_mutex_lock(&jobs.lock);
+    jobs.range_done++;
+    pthread_cond_broadcast(&jobs.changed);
+    return true;
+}
+
+static void* job_worker(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&jobs.lock);
+    while (!jobs.stopping)
+    {
+        if (range_run()) continue;
+        job_entry_t *entry = job_next();
+        if (entry) job_run(entry);
+        else pthread_cond_wait(&jobs.changed, &jobs.lock);
+    }
+    pthread_mutex_unlock(&jobs.lock);
+    return NULL;
+}
+
+// --jobs counts the main thread too, it helps out whenever it waits on a job
+static void jobs_start(void)
+{
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = config.jobs ? config.jobs : (cores > 0 ? (uint32_t) cores : 1);
+    if (threads - 1 > MAX_JOB_WORKERS) threads = MAX_JOB_WORKERS + 1;
+
+    jobs.started = true;
+    for (uint32_t i = 0; i + 1 < threads; i++)
+    {
+        if (pthread_create(&jobs.workers[jobs.worker_count], NULL, job_worker, NULL) != 0)
+        {
+            fprintf(stderr, "Warning: Started only %u of %u job workers\n", jobs.worker_count, threads - 1);
+            break;
+        }
+        jobs.worker_count++;
+    }
+}
+
+job_t job_add(const char *name, const job_fn fn, void *user, const job_t *deps, const uint32_t dep_count)
+{
+    pthread_mutex_lock(&jobs.lock);
+    if (!jobs.started) jobs_start();
+    ASSERT(jobs.count < MAX_JOBS, "job table is full");
+    ASSERT(dep_count <= MAX_JOB_DEPS, "job has too many dependencies");
+
+    job_entry_t *entry = &jobs.entries[jobs.count];
+    *entry = (job_entry_t){.name = name, .fn = fn, .user = user, .status = JOB_PENDING};
+    for (uint32_t i = 0; i < dep_count; i++)
+    {
+        if (!deps[i]) continue;
+        ASSERT(deps[i] <= jobs.count, "job depends on a job that does not exist yet");
+        entry->deps[entry->dep_count++] = deps[i];
+    }
+
+    jobs.count++;
+    jobs.unfinished++;
+    const job_t job = jobs.count;
+    pthread_cond_broadcast(&jobs.changed);
+    pthread_mutex_unlock(&jobs.lock);
+    return job;
+}
+
+void jobs_wait(const job_t job)
+{
+    if (!job) return;
+
+    pthread_mutex_lock(&jobs.lock);
+    ASSERT(job <= jobs.count, "waiting on a job that does not exist");
+    job_entry_t *target = &jobs.entries[job - 1];
+    while (target->status != JOB_DONE)
+    {
+        // Prefer the job being waited on, otherwise make progress on anything that is ready
+        job_entry_t *entry = job_ready(target) ? target : job_next();
+        if (entry) job_run(entry);
+        else pthread_cond_wait(&jobs.changed, &jobs.lock);
+    }
+    pthread_mutex_unlock(&jobs.lock);
+}
+
+void jobs_parallel_for(const char *name, const job_range_fn fn, void *user, const uint32_t count)
+{
+    if (count == 0) return;
+
+    pthread_mutex_lock(&jobs.lock);
+    if (!jobs.started) jobs_start();
+    ASSERT(!jobs.range_fn, "jobs_parallel_for is already running");
+
+    jobs.range_name = name;
+    jobs.range_fn = fn;
+    jobs.range_user = user;
+    jobs.range_next = 0;
+    jobs.range_count = count;
+    jobs.range_done = 0;
+    pthread_cond_broadcast(&jobs.changed);
+
+    while (jobs.range_done < jobs.range_count)
+        if (!range_run()) pthread_cond_wait(&jobs.changed, &jobs.lock);
+
+    jobs.range_fn = NULL;
+    pthread_mutex_unlock(&jobs.lock);
+}
+
+void jobs_stop(void)
+{
+    pthread_mutex_lock(&jobs.lock);
+    while (jobs.unfinished)
+    {
+        job_entry_t *entry = job_next();
+        if (entry) job_run(entry);
+        else pthread_cond_wait(&jobs.changed, &jobs.lock);
+    }
+    jobs.stopping = true;
+    pthread_cond_broadcast(&jobs.changed);
+    pthread_mutex_unlock(&jobs.lock);
+
+    for (uint32_t i = 0; i < jobs.worker_count; i++) pthread_join(jobs.workers[i], NULL);
+
+    jobs.worker_count = 0;
+    jobs.count = 0;
+    jobs.started = false;
+    jobs.stopping = false;
+}
@@ -0,0 +1,121 @@
+#include "App.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Resource pack
+//
+// The whole file is mapped read-only, lookups binary search the sorted entry table and hand out
+// pointers into the mapping, so loading a packed texture is a memcpy into staging and nothing else.
+// The pack opens on the first lookup, which can be a startup job running before VK_START, and stays
+// mapped until the process exits since levels and shaders may point into it at any time.
+
+static struct
+{
+    const uint8_t *data;
+    size_t size;
+    const pack_entry_t *entries;
+    uint32_t entry_count;
+} pack;
+
+static pthread_once_t pack_once = PTHREAD_ONCE_INIT;
+
+// The mip chain has to fit the entry, create_texture_from_pack copies that much out of it
+static bool pack_texture_valid(const pack_entry_t *entry)
+{
+    if (!entry->width || !entry->height || !entry->mip_levels || entry->mip_levels > 32) return false;
+
+    uint64_t remaining = entry->size;
+    for (uint32_t level = 0, w = entry->width, h = entry->height; level < entry->mip_levels; level++)
+    {
+        const uint64_t level_size = (uint64_t) w * h;
+        if (level_size > remaining / 4) return false;
+        remaining -= level_size * 4;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return true;
+}
+
+static bool pack_valid(const uint8_t *data, const size_t size)
+{
+    if (size < sizeof(pack_header_t)) return false;
+
+    const pack_header_t *header = (const pack_header_t *) data;
+    if (header->magic != PACK_MAGIC || header->version != PACK_VERSION) return false;
+    if (header->entry_count > (size - sizeof(pack_header_t)) / sizeof(pack_entry_t)) return false;
+
+    const pack_entry_t *entries = (const pack_entry_t *) (header + 1);
+    for (uint32_t i = 0; i < header->entry_count; i++)
+    {
+        if (memchr(entries[i].name, '\0', PACK_NAME_LENGTH) == NULL) return false;
+        if (entries[i].offset > size || entries[i].size > size - entries[i].offset) return false;
+        if (i > 0 && strcmp(entries[i - 1].name, entries[i].name) >= 0) return false;
+        if (entries[i].type == PACK_TEXTURE && !pack_texture_valid(&entries[i])) return false;
+    }
+    return true;
+}
+
+static void pack_open(void)
+{
+    if (!config.pack_path) return;
+
+    const int fd = open(config.pack_path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Warning: Could not open resource pack %s, loading loose files\n", config.pack_path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    const size_t size = (size_t) info.st_size;
+    void *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (data == MAP_FAILED || !pack_valid(data, size))
+    {
+        fprintf(stderr, "Warning: %s is not a resource pack for this engine version, loading loose files\n", config.pack_path);
+        if (data != MAP_FAILED) munmap(data, size);
+        return;
+    }
+
+    pack.data = data;
+    pack.size = size;
+    pack.entry_count = ((const pack_header_t *) data)->entry_count;
+    pack.entries = (const pack_entry_t *) (pack.data + sizeof(pack_header_t));
+    printf("Resource pack %s: %u entries, %zu KB\n", config.pack_path, pack.entry_count, pack.size / 1024);
+}
+
+static int pack_compare(const void *name, const void *entry)
+{
+    return strcmp((const char *) name, ((const pack_entry_t *) entry)->name);
+}
+
+const pack_entry_t* pack_find(const char *name)
+{
+    pthread_once(&pack_once, pack_open);
+    if (!pack.entry_count || !name) return NULL;
+    return bsearch(name, pack.entries, pack.entry_count, sizeof(pack_entry_t), pack_compare);
+}
+
+const void* pack_data(const pack_entry_t *entry)
+{
+    return pack.data + entry->offset;
+}
+
+FILE* pack_fopen(const char *path)
+{
+    const pack_entry_t *entry = pack_find(path);
+    if (entry && entry->type == PACK_FILE && entry->size)
+    {
+        // fmemopen never writes to a stream opened for reading, so the read-only mapping is safe
+        FILE *file = fmemopen((void *) pack_data(entry), (size_t) entry->size, "r");
+        if (file) return file;
+    }
+    return fopen(path, "r");
+}
@@ -0,0 +1,250 @@
+#include "App.h"
+#include "util.h"
+
+// CPU profiling zones
+//
+// Every thread that opens a zone gets its own ring of finished zones. The owning thread is the only
+// writer and publishes with a release store of the head, so recording never takes a lock. The main
+// thread folds new events into state.cpu_zones once per frame and can dump the rings as a Chrome
+// trace (chrome://tracing, ui.perfetto.dev). With ENGINE_PROFILE=0 the zone macros expand to nothing
+// and the functions below are empty.
+
+#if ENGINE_PROFILE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+    uint32_t depth;
+} profile_event_t;
+
+typedef struct
+{
+    profile_event_t events[PROFILE_RING_EVENTS];
+    _Atomic uint64_t head; // events ever written, only the owning thread stores it
+    uint64_t read;         // folded into state.cpu_zones, main thread only
+    uint32_t thread_id; // registration order, jobs may open zones before the main thread does
+    bool main_thread;
+
+    uint32_t depth;
+    const char *stack_name[PROFILE_MAX_DEPTH];
+    uint64_t stack_begin[PROFILE_MAX_DEPTH];
+} profile_thread_t;
+
+static _Atomic(profile_thread_t *) profile_threads[PROFILE_MAX_THREADS];
+static _Atomic uint32_t profile_thread_count;
+static _Thread_local profile_thread_t *profile_local;
+static _Thread_local bool profile_disabled;
+static pthread_t profile_main;
+static bool profile_main_set;
+
+// Tick source and the wall clock at the first zone, used to convert ticks to time
+static _Atomic bool profile_started;
+static uint64_t profile_epoch_ticks;
+static double profile_epoch_time;
+
+static inline uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+// rdtsc runs at a fixed but unknown rate, measure it against the monotonic clock since the epoch
+static double profile_ticks_per_ms(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const double elapsed = VK_GETTIME() - profile_epoch_time;
+    const uint64_t ticks = profile_ticks() - profile_epoch_ticks;
+    if (elapsed <= 0.0 || ticks == 0) return 1e6;
+    return (double) ticks / (elapsed * 1000.0);
+#else
+    return 1e6;
+#endif
+}
+
+static profile_thread_t* profile_register(void)
+{
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&profile_started, &expected, true))
+    {
+        profile_epoch_time = VK_GETTIME();
+        profile_epoch_ticks = profile_ticks();
+    }
+
+    const uint32_t index = atomic_fetch_add(&profile_thread_count, 1);
+    if (index >= PROFILE_MAX_THREADS)
+    {
+        profile_disabled = true;
+        return NULL;
+    }
+
+    profile_thread_t *thread = calloc(1, sizeof(profile_thread_t));
+    ASSERT(thread, "failed to allocate profiler ring");
+    thread->thread_id = index;
+    thread->main_thread = profile_main_set && pthread_equal(pthread_self(), profile_main);
+    atomic_store_explicit(&profile_threads[index], thread, memory_order_release);
+    return thread;
+}
+
+void profile_main_thread(void)
+{
+    profile_main = pthread_self();
+    profile_main_set = true;
+}
+
+void profile_begin(const char *name)
+{
+    profile_thread_t *thread = profile_local;
+    if (!thread)
+    {
+        if (profile_disabled) return;
+        thread = profile_local = profile_register();
+        if (!thread) return;
+    }
+
+    // Too deep, count the level so the matching end still pairs up
+    const uint32_t depth = thread->depth++;
+    if (depth >= PROFILE_MAX_DEPTH) return;
+    thread->stack_name[depth] = name;
+    thread->stack_begin[depth] = profile_ticks();
+}
+
+void profile_end(void)
+{
+    profile_thread_t *thread = profile_local;
+    if (!thread || thread->depth == 0) return;
+
+    const uint64_t end = profile_ticks();
+    const uint32_t depth = --thread->depth;
+    if (depth >= PROFILE_MAX_DEPTH) return;
+
+    const uint64_t head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+    profile_event_t *event = &thread->events[head & (PROFILE_RING_EVENTS - 1)];
+    event->name = thread->stack_name[depth];
+    event->begin = thread->stack_begin[depth];
+    event->end = end;
+    event->depth = depth;
+    atomic_store_explicit(&thread->head, head + 1, memory_order_release);
+}
+
+void profile_frame(void)
+{
+    cpu_zone_t zones[MAX_CPU_ZONES];
+    uint64_t first_begin[MAX_CPU_ZONES];
+    uint32_t zone_count = 0;
+    const double ticks_per_ms = profile_ticks_per_ms();
+
+    const uint32_t thread_count = atomic_load(&profile_thread_count);
+    for (uint32_t t = 0; t < thread_count && t < PROFILE_MAX_THREADS; t++)
+    {
+        profile_thread_t *thread = atomic_load_explicit(&profile_threads[t], memory_order_acquire);
+        if (!thread) continue;
+
+        // Anything the writer lapped since the last frame is lost, only the newest ring full counts
+        const uint64_t head = atomic_load_explicit(&thread->head, memory_order_acquire);
+        uint64_t i = thread->read;
+        if (head - i > PROFILE_RING_EVENTS) i = head - PROFILE_RING_EVENTS;
+        thread->read = head;
+
+        for (; i < head; i++)
+        {
+            const profile_event_t *event = &thread->events[i & (PROFILE_RING_EVENTS - 1)];
+
+            uint32_t z = 0;
+            while (z < zone_count && (zones[z].depth != event->depth ||
+                                      (zones[z].name != event->name && strcmp(zones[z].name, event->name) != 0))) z++;
+            if (z == MAX_CPU_ZONES) continue;
+            if (z == zone_count)
+            {
+                zones[z] = (cpu_zone_t){.name = event->name, .depth = event->depth};
+                first_begin[z] = event->begin;
+                zone_count++;
+            }
+
+            zones[z].ms += (double) (event->end - event->begin) / ticks_per_ms;
+            zones[z].calls++;
+            if (event->begin < first_begin[z]) first_begin[z] = event->begin;
+        }
+    }
+
+    // Children finish before their parents, list zones in the order they started instead
+    for (uint32_t i = 1; i < zone_count; i++)
+    {
+        const cpu_zone_t zone = zones[i];
+        const uint64_t begin = first_begin[i];
+        uint32_t j = i;
+        for (; j > 0 && first_begin[j - 1] > begin; j--)
+        {
+            zones[j] = zones[j - 1];
+            first_begin[j] = first_begin[j - 1];
+        }
+        zones[j] = zone;
+        first_begin[j] = begin;
+    }
+
+    memcpy(state.cpu_zones, zones, sizeof(cpu_zone_t) * zone_count);
+    state.cpu_zone_count = zone_count;
+}
+
+// Other threads may overwrite the oldest events while this runs, at worst a few zones come out garbled
+bool profile_export(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+
+    const double ticks_per_us = profile_ticks_per_ms() / 1000.0;
+    bool first = true;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const uint32_t thread_count = atomic_load(&profile_thread_count);
+    for (uint32_t t = 0; t < thread_count && t < PROFILE_MAX_THREADS; t++)
+    {
+        profile_thread_t *thread = atomic_load_explicit(&profile_threads[t], memory_order_acquire);
+        if (!thread) continue;
+
+        fprintf(file, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s %u\"}}",
+                first ? "" : ",\n", thread->thread_id, thread->main_thread ? "main" : "worker", thread->thread_id);
+        first = false;
+
+        const uint64_t head = atomic_load_explicit(&thread->head, memory_order_acquire);
+        const uint64_t start = head > PROFILE_RING_EVENTS ? head - PROFILE_RING_EVENTS : 0;
+        for (uint64_t i = start; i < head; i++)
+        {
+            const profile_event_t *event = &thread->events[i & (PROFILE_RING_EVENTS - 1)];
+            fprintf(file, ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    event->name, thread->thread_id,
+                    (double) (event->begin - profile_epoch_ticks) / ticks_per_us,
+                    (double) (event->end - event->begin) / ticks_per_us);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Profile trace written to %s\n", path);
+    return true;
+}
+
+#else
+
+void profile_main_thread(void) {}
+void profile_frame(void) {}
+
+bool profile_export(const char *path)
+{
+    (void) path;
+    return false;
+}
+
+#endif
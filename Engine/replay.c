@@ -0,0 +1,136 @@
+#include "App.h"
+#include "util.h"
+
+// Deterministic input recording and replay
+//
+// While recording or replaying, every frame advances by a fixed timestep instead of the measured one,
+// so the same keys always move the camera the same way. A recording stores one line per frame:
+//
+//   frame timestep level x z yaw pitch keycount key...
+//
+// The camera is the one INPUT started from, replay compares it to catch builds that diverge. The keys
+// are the ones INPUT saw held through VK_KEYDOWN that frame. The engine hotkeys are never recorded and
+// stay live during a replay, so a recording can't quit, capture or export on its own.
+
+static struct
+{
+    FILE *file;
+    uint64_t frame;
+    int keys[REPLAY_MAX_KEYS];
+    uint32_t key_count;
+    int level;
+    cam_t cam;
+    bool diverged;
+} replay;
+
+void replay_start(void)
+{
+    memset(&replay, 0, sizeof(replay));
+    if (config.replay_path)
+    {
+        replay.file = fopen(config.replay_path, "r");
+        ASSERT(replay.file, "could not open input recording");
+        printf("Replaying input from %s\n", config.replay_path);
+    }
+    else if (config.record_path)
+    {
+        replay.file = fopen(config.record_path, "w");
+        ASSERT(replay.file, "could not create input recording");
+        fprintf(replay.file, "# frame timestep level x z yaw pitch keycount key...\n");
+        printf("Recording input to %s\n", config.record_path);
+    }
+}
+
+bool replay_frame(void)
+{
+    if (!replay.file) return true;
+    replay.frame++;
+
+    if (config.record_path && !config.replay_path)
+    {
+        replay.key_count = 0;
+        replay.level = state.level_id;
+        replay.cam = state.cam;
+        state.delta_time = REPLAY_TIMESTEP;
+        return true;
+    }
+
+    char line[1024];
+    do
+    {
+        if (!fgets(line, sizeof(line), replay.file))
+        {
+            replay.key_count = 0;
+            printf("Replay finished after %llu frames\n", (unsigned long long) replay.frame - 1);
+            return false;
+        }
+    } while (line[0] == '#' || line[0] == '\n');
+
+    unsigned long long frame = 0;
+    unsigned int key_count = 0;
+    float timestep = REPLAY_TIMESTEP;
+    int offset = 0;
+    const int read = sscanf(line, "%llu %f %d %f %f %f %f %u%n", &frame, &timestep, &replay.level,
+                            &replay.cam.x, &replay.cam.z, &replay.cam.yaw, &replay.cam.pitch, &key_count, &offset);
+    ASSERT(read == 8, "malformed input recording");
+
+    replay.key_count = 0;
+    const char *cursor = line + offset;
+    for (unsigned int i = 0; i < key_count && replay.key_count < REPLAY_MAX_KEYS; i++)
+    {
+        int key, consumed;
+        if (sscanf(cursor, "%d%n", &key, &consumed) != 1) break;
+        replay.keys[replay.key_count++] = key;
+        cursor += consumed;
+    }
+
+    // Warn once, after that every frame would differ anyway
+    const float epsilon = 1e-4f;
+    if (!replay.diverged && (replay.level != state.level_id ||
+                             fabsf(replay.cam.x - state.cam.x) > epsilon || fabsf(replay.cam.z - state.cam.z) > epsilon ||
+                             fabsf(replay.cam.yaw - state.cam.yaw) > epsilon || fabsf(replay.cam.pitch - state.cam.pitch) > epsilon))
+    {
+        fprintf(stderr, "Warning: Replay diverged from the recording at frame %llu\n", frame);
+        replay.diverged = true;
+    }
+
+    state.delta_time = timestep;
+    return true;
+}
+
+bool replay_keydown(const int key)
+{
+    for (uint32_t i = 0; i < replay.key_count; i++)
+        if (replay.keys[i] == key) return true;
+    return false;
+}
+
+bool replay_engine_key(const int key)
+{
+    return key == GLFW_KEY_ESCAPE || key == PROFILE_TRACE_KEY || key == FRAME_CSV_KEY || key == CAPTURE_KEY;
+}
+
+void replay_key(const int key)
+{
+    if (replay_engine_key(key) || replay_keydown(key) || replay.key_count >= REPLAY_MAX_KEYS) return;
+    replay.keys[replay.key_count++] = key;
+}
+
+void replay_end_frame(void)
+{
+    if (!replay.file || config.replay_path) return;
+
+    // %.9g round-trips a float, so replay starts every frame from bit-identical values
+    fprintf(replay.file, "%llu %.9g %d %.9g %.9g %.9g %.9g %u", (unsigned long long) replay.frame, REPLAY_TIMESTEP,
+            replay.level, replay.cam.x, replay.cam.z, replay.cam.yaw, replay.cam.pitch, replay.key_count);
+    for (uint32_t i = 0; i < replay.key_count; i++) fprintf(replay.file, " %d", replay.keys[i]);
+    fprintf(replay.file, "\n");
+}
+
+void replay_finish(void)
+{
+    if (!replay.file) return;
+    fclose(replay.file);
+    replay.file = NULL;
+    if (config.replay_path && replay.diverged) state.exit_code = 1;
+}
@@ -4,13 +4,21 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 tex_coord;
 layout(location = 2) in vec4 color;
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
-} push_constants;
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+} camera;
+
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
+    vec4 tint_color;
+    float tiling;
+} draw;
 
 layout(location = 0) out vec4 frag_color;
 
 void main() {
-    gl_Position = push_constants.mvp * vec4(position, 1.0);
+    gl_Position = camera.view_proj * draw.model * vec4(position, 1.0);
     frag_color = color;
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+#version 450
+
+layout(location = 0) in vec3 in_pos;
+layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec4 in_color;
+
+// cube_instance_t, one per instance
+layout(location = 4) in vec3 instance_position;
+layout(location = 5) in vec3 instance_rotation;
+layout(location = 6) in vec3 instance_scale;
+layout(location = 7) in vec4 instance_color;
+
+layout(location = 0) out vec2 frag_uv;
+layout(location = 1) out vec4 frag_color;
+
+// The model matrix is built from the instance, draw.model goes unused
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+} camera;
+
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
+    vec4 tint_color;
+    float tiling;
+} draw;
+
+// --depth-prepass draws the same geometry twice and tests EQUAL, both passes must agree bit for bit
+invariant gl_Position;
+
+// X, then Y, then Z
+mat3 rotation(vec3 angles)
+{
+    vec3 s = sin(angles);
+    vec3 c = cos(angles);
+    mat3 rx = mat3(1.0, 0.0, 0.0,  0.0, c.x, s.x,  0.0, -s.x, c.x);
+    mat3 ry = mat3(c.y, 0.0, -s.y,  0.0, 1.0, 0.0,  s.y, 0.0, c.y);
+    mat3 rz = mat3(c.z, s.z, 0.0,  -s.z, c.z, 0.0,  0.0, 0.0, 1.0);
+    return rz * ry * rx;
+}
+
+void main()
+{
+    vec3 world = rotation(instance_rotation) * (in_pos * instance_scale) + instance_position;
+    gl_Position = camera.view_proj * vec4(world, 1.0);
+    frag_uv = in_uv * draw.tiling;
+    frag_color = in_color * instance_color;
+}
@@ -0,0 +1,20 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 frag_uv;
+layout(location = 1) in vec4 frag_color;
+layout(location = 2) flat in uint frag_material;
+layout(location = 0) out vec4 out_color;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
+    vec4 tint_color;
+    float tiling;
+} draw;
+
+void main()
+{
+    out_color = texture(textures[nonuniformEXT(frag_material)], frag_uv) * draw.tint_color * frag_color;
+}
@@ -0,0 +1,34 @@
+#version 450
+
+layout(location = 0) in vec3 in_pos;
+layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec4 in_color;
+layout(location = 3) in uint in_material;
+
+layout(location = 0) out vec2 frag_uv;
+layout(location = 1) out vec4 frag_color;
+layout(location = 2) flat out uint frag_material;
+
+// Set 0 is the frame's camera and this draw's slot in the uniform ring, shared by every pipeline
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+} camera;
+
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
+    vec4 tint_color;
+    float tiling;
+} draw;
+
+// --depth-prepass draws the same geometry twice and tests EQUAL, both passes must agree bit for bit
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = camera.view_proj * draw.model * vec4(in_pos, 1.0);
+    frag_uv = in_uv * draw.tiling;
+    frag_color = in_color;
+    frag_material = in_material;
+}
@@ -4,15 +4,15 @@ layout(location = 0) in vec2 frag_uv;
 layout(location = 1) in vec4 frag_color;
 layout(location = 0) out vec4 out_color;
 
-layout(set = 0, binding = 0) uniform sampler2D texSampler;
+layout(set = 1, binding = 0) uniform sampler2D texSampler;
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
     vec4 tint_color;
     float tiling;
-} pc;
+} draw;
 
 void main()
 {
-    out_color = texture(texSampler, frag_uv) * pc.tint_color * frag_color;
+    out_color = texture(texSampler, frag_uv) * draw.tint_color * frag_color;
 }
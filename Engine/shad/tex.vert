@@ -7,15 +7,25 @@ layout(location = 2) in vec4 in_color;
 layout(location = 0) out vec2 frag_uv;
 layout(location = 1) out vec4 frag_color;
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
+// Set 0 is the frame's camera and this draw's slot in the uniform ring, shared by every pipeline
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+} camera;
+
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
     vec4 tint_color;
     float tiling;
-} pc;
+} draw;
+
+// --depth-prepass draws the same geometry twice and tests EQUAL, both passes must agree bit for bit
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = pc.mvp * vec4(in_pos, 1.0);
-    frag_uv = in_uv * pc.tiling;
+    gl_Position = camera.view_proj * draw.model * vec4(in_pos, 1.0);
+    frag_uv = in_uv * draw.tiling;
     frag_color = in_color;
 }
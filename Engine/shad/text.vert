@@ -7,15 +7,16 @@ layout(location = 2) in vec4 in_color;
 layout(location = 0) out vec2 frag_uv;
 layout(location = 1) out vec4 frag_color;
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
+// The overlay ignores the camera, its model matrix maps straight to clip space
+layout(set = 0, binding = 1) uniform Draw {
+    mat4 model;
     vec4 tint_color;
     float tiling;
-} pc;
+} draw;
 
 void main()
 {
-    gl_Position = pc.mvp * vec4(in_pos, 1.0);
+    gl_Position = draw.model * vec4(in_pos, 1.0);
     frag_uv = in_uv;
     frag_color = in_color;
 }
@@ -0,0 +1,68 @@
+#include "App.h"
+
+// Compiled-in SPIR-V
+//
+// The build runs glslangValidator --vn over every shader in Engine/shad, which writes the SPIR-V as a
+// uint32_t array named <shader>_<stage>_spv into a header. Those are linked in here and found by the
+// name the .spv file would have, so startup never opens a shader file. Without glslangValidator the
+// build sets ENGINE_EMBED_SHADERS=0 and the table is empty, App.c then reads from SHADER_DIR.
+
+#ifndef ENGINE_EMBED_SHADERS
+#define ENGINE_EMBED_SHADERS 0
+#endif
+
+typedef struct
+{
+    const char *name;
+    const uint32_t *code;
+    size_t size;
+} embedded_shader_t;
+
+#if ENGINE_EMBED_SHADERS
+
+#include "col.vert.h"
+#include "col.frag.h"
+#include "tex.vert.h"
+#include "tex.frag.h"
+#include "text.vert.h"
+#include "text.frag.h"
+#include "level.vert.h"
+#include "level.frag.h"
+#include "cube.vert.h"
+#include "cube.frag.h"
+#include "cull.comp.h"
+
+#define EMBEDDED_SHADER(shader, stage) {#shader "." #stage ".spv", shader##_##stage##_spv, sizeof(shader##_##stage##_spv)}
+
+static const embedded_shader_t embedded_shaders[] = {
+    EMBEDDED_SHADER(col, vert),
+    EMBEDDED_SHADER(col, frag),
+    EMBEDDED_SHADER(tex, vert),
+    EMBEDDED_SHADER(tex, frag),
+    EMBEDDED_SHADER(text, vert),
+    EMBEDDED_SHADER(text, frag),
+    EMBEDDED_SHADER(level, vert),
+    EMBEDDED_SHADER(level, frag),
+    EMBEDDED_SHADER(cube, vert),
+    EMBEDDED_SHADER(cube, frag),
+    EMBEDDED_SHADER(cull, comp)
+};
+static const uint32_t embedded_shader_count = sizeof(embedded_shaders) / sizeof(embedded_shaders[0]);
+
+#else
+
+static const embedded_shader_t *embedded_shaders = NULL;
+static const uint32_t embedded_shader_count = 0;
+
+#endif
+
+const uint32_t* shader_lookup(const char *name, size_t *size)
+{
+    for (uint32_t i = 0; i < embedded_shader_count; i++)
+    {
+        if (strcmp(embedded_shaders[i].name, name) != 0) continue;
+        *size = embedded_shaders[i].size;
+        return embedded_shaders[i].code;
+    }
+    return NULL;
+}
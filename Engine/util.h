@@ -15,20 +15,33 @@
     } \
 } while(0)
 
-static vec4 tint = {1, 1 ,1 ,1};
+// Per thread, so vk_cmd_parallel slices can set their own
+static _Thread_local vec4 tint = {1, 1 ,1 ,1};
 #define VK_TINT(r, g, b, a) do { \
     tint[0] = r; tint[1] = g; tint[2] = b; tint[3] = a; \
 } while(0)
 
-static float texture_tiling = 1.0f;
+static _Thread_local float texture_tiling = 1.0f;
 #define VK_TILETEXTURE(scale) do { \
     texture_tiling = scale; \
 } while(0)
 
-VkDescriptorSet* vk_get_texture(const char* path);
-static VkDescriptorSet *current_texture = NULL;
-#define VK_TEXTURE(path) do { \
-    current_texture = vk_get_texture(path); \
+texture_handle_t vk_texture_handle(const char* path, texture_flags_t flags);
+VkDescriptorSet vk_texture_bind(texture_handle_t handle, uint32_t *material); // material may be NULL
+uint32_t vk_texture_material(texture_handle_t handle);
+static _Thread_local VkDescriptorSet current_texture = VK_NULL_HANDLE;
+static _Thread_local uint32_t current_material = 0;
+
+// Resolve a path to a handle once, at load time, then bind it every frame with VK_TEXTURE_HANDLE
+#define VK_TEXTURE_FLAGS(path, flags) vk_texture_handle((path), (flags))
+#define VK_TEXTURE(path) VK_TEXTURE_FLAGS(path, TEXTURE_DEFAULT)
+
+// Same as VK_TEXTURE but with a generated mip chain, use for textures that tile into the distance
+#define VK_TEXTURE_MIPMAPPED(path) VK_TEXTURE_FLAGS(path, TEXTURE_MIPMAPPED)
+
+// One registry access and no string work, sets both the descriptor set and the bindless material
+#define VK_TEXTURE_HANDLE(handle) do { \
+    current_texture = vk_texture_bind((handle), &current_material); \
 } while(0)
 
 static void _draw_char(const char c, const float x, const float y, const float char_width, const float char_height)
@@ -79,38 +92,51 @@ static inline void vk_drawtextf(const float x, const float y, const char *fmt, .
 }
 #define VK_DRAWTEXTF(x, y, fmt, ...) vk_drawtextf((x), (y), (fmt), __VA_ARGS__)
 
+// Queued rather than recorded, so cubes sharing a texture draw together and front to back
 static inline void _draw_cube(const float x, const float y, const float z, const float rotY, const float scale)
 {
-    mat4 model, view, proj, mvp;
-
-    glm_mat4_identity(model);
-    glm_translate(model, (vec3){x, y, z});
-    glm_rotate(model, rotY, (vec3){0.0f, 1.0f, 0.0f});
-    glm_scale_uni(model, scale);
-
-    glm_mat4_identity(view);
-    glm_rotate(view, state.cam.pitch, (vec3){1.0f, 0.0f, 0.0f});
-    glm_rotate(view, state.cam.yaw, (vec3){0.0f, 1.0f, 0.0f});
-    glm_translate(view, (vec3){-state.cam.x, -state.cam.y, -state.cam.z});
-
-    glm_perspective(glm_rad(FOV_DEGREES), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE, proj);
-    glm_mat4_mul(proj, view, mvp);
-    glm_mat4_mul(mvp, model, mvp);
-
-    push_constants_textured_t pc;
-
-    glm_mat4_copy(mvp, pc.mvp);
-    glm_vec4_copy(tint, pc.tint_color);
-    pc.tiling = texture_tiling;
-
-    const VkDescriptorSet *tex_to_use = current_texture ? current_texture : &board_descriptor_set;
-    vkCmdBindDescriptorSets(state.v.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state.v.textured_pipeline.layout, 0, 1, tex_to_use, 0, NULL);
-
-    vkCmdPushConstants(
-        state.v.commandBuffer, state.v.textured_pipeline.layout,
-        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push_constants_textured_t), &pc
-    );
-
-    vkCmdDraw(state.v.commandBuffer, state.v.cube_buffer.vertex_count, 1, 0, 0);
+    if (state.v.deferredPending) return; // the cube mesh and board texture arrive next frame under --lazy-init
+
+    draw_packet_t packet = {
+        .pass = DRAW_PASS_OPAQUE,
+        .depth = glm_vec3_distance((vec3){x, y, z}, (vec3){state.cam.x, state.cam.y, state.cam.z}),
+        .pipeline = &state.v.textured_pipeline,
+        .set = current_texture ? current_texture : board_descriptor_set,
+        .vertices = &state.v.cube_buffer,
+        .vertex_count = state.v.cube_buffer.vertex_count
+    };
+    glm_mat4_identity(packet.uniforms.model);
+    glm_translate(packet.uniforms.model, (vec3){x, y, z});
+    glm_rotate(packet.uniforms.model, rotY, (vec3){0.0f, 1.0f, 0.0f});
+    glm_scale_uni(packet.uniforms.model, scale);
+    glm_vec4_copy(tint, packet.uniforms.tint_color);
+    packet.uniforms.tiling = texture_tiling;
+    vk_queue_draw(&packet);
 }
 #define VK_DRAWCUBE(x, y, z, rotY, scale) _draw_cube((x), (y), (z), (rotY), (scale))
+
+// Every cube in one draw with the current texture, tint and tiling, culled against the camera on the GPU.
+// The instances are copied right away and the draw is queued as opaque at depth, the batch's distance
+// from the camera, so batches sort front to back and go through the depth pre-pass.
+static inline void _draw_cubes(const cube_instance_t *instances, const uint32_t count, const float depth)
+{
+    if (state.v.deferredPending) return; // the instanced pipeline, cube mesh and board texture arrive next frame under --lazy-init
+
+    draw_packet_t packet = {
+        .pass = DRAW_PASS_OPAQUE,
+        .depth = depth,
+        .pipeline = &state.v.instanced_pipeline,
+        .set = current_texture ? current_texture : board_descriptor_set,
+        .vertices = &state.v.cube_buffer,
+        .vertex_count = state.v.cube_buffer.vertex_count,
+        .instances = vk_stage_instances(state.v.cube_buffer.vertex_count, instances, count, state.camera.view_proj)
+    };
+    if (packet.instances.count == 0) return;
+
+    // The instances carry the model matrix, only tint and tiling come from here
+    glm_mat4_identity(packet.uniforms.model);
+    glm_vec4_copy(tint, packet.uniforms.tint_color);
+    packet.uniforms.tiling = texture_tiling;
+    vk_queue_draw(&packet);
+}
+#define VK_DRAWCUBES(instances, count, depth) _draw_cubes((instances), (count), (depth))
@@ -0,0 +1,330 @@
+#include "Engine/App.h"
+#include "Engine/util.h"
+
+#define LEVEL_RENDERING
+#include "level.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// CPU microbenchmarks for the level and text hot paths, no window or GPU is created
+//
+//   bench [--out FILE] [--samples N] [--warmup N] [--filter NAME]
+//
+// Every benchmark runs over the shipped levels and over synthetic grids of increasing size. The
+// iteration count of a sample is doubled until it takes BENCH_MIN_SAMPLE_MS, then warmup samples are
+// thrown away and the timed samples are summarised as ns per operation. Results go to a JSON file so
+// runs from different commits can be diffed.
+
+#define BENCH_OUT "bench.json"
+#define BENCH_SAMPLES 15
+#define BENCH_WARMUP 3
+#define BENCH_MIN_SAMPLE_MS 5.0
+#define BENCH_MAX_SAMPLES 256
+#define BENCH_POINTS 1024
+#define BENCH_CELL 4.0f
+
+// Grid width in sectors, up to 4096 sectors and 16384 walls. level_render stops adding walls at
+// MAX_WALL_VERTICES, so the larger grids time its culling walk more than its vertex output.
+static const int synthetic_sizes[] = {1, 4, 16, 64};
+
+typedef struct
+{
+    const char *name;
+    level_t level;
+    float min_x, min_z, max_x, max_z;
+    float points[BENCH_POINTS][2];
+} bench_level_t;
+
+typedef void (*bench_fn)(const bench_level_t *level, uint64_t iterations);
+
+static struct
+{
+    const char *out_path;
+    uint32_t samples;
+    uint32_t warmup;
+    const char *filter;
+    FILE *out;
+    bool first_result;
+} bench = {BENCH_OUT, BENCH_SAMPLES, BENCH_WARMUP, NULL, NULL, true};
+
+// Results are folded in here so the compiler cannot drop the work
+static volatile uintptr_t bench_sink;
+
+// Deterministic so every run and every commit measures the same points
+static uint32_t bench_random_state = 0x12345678u;
+static float bench_random(const float min, const float max)
+{
+    bench_random_state = bench_random_state * 1664525u + 1013904223u;
+    return min + (max - min) * (float) (bench_random_state >> 8) / (float) (1u << 24);
+}
+
+static void bench_prepare(bench_level_t *bench_level)
+{
+    level_t *level = &bench_level->level;
+    bench_level->min_x = bench_level->min_z = INFINITY;
+    bench_level->max_x = bench_level->max_z = -INFINITY;
+
+    for (uint32_t s = 0; s < level->sector_count; s++)
+    {
+        for (uint32_t w = 0; w < level->sectors[s].wall_count; w++)
+        {
+            // Materials resolve through the GPU texture registry, keep the timing to vertex generation
+            wall_t *wall = &level->sectors[s].walls[w];
+            wall->texture_path = NULL;
+
+            bench_level->min_x = fminf(bench_level->min_x, fminf(wall->x1, wall->x2));
+            bench_level->max_x = fmaxf(bench_level->max_x, fmaxf(wall->x1, wall->x2));
+            bench_level->min_z = fminf(bench_level->min_z, fminf(wall->z1, wall->z2));
+            bench_level->max_z = fmaxf(bench_level->max_z, fmaxf(wall->z1, wall->z2));
+        }
+    }
+
+    for (uint32_t i = 0; i < BENCH_POINTS; i++)
+    {
+        bench_level->points[i][0] = bench_random(bench_level->min_x, bench_level->max_x);
+        bench_level->points[i][1] = bench_random(bench_level->min_z, bench_level->max_z);
+    }
+}
+
+// A grid of square sectors, inner edges are doors so adjacency and floor steps get exercised
+static void write_synthetic_level(const char *path, const int size)
+{
+    FILE *file = fopen(path, "w");
+    ASSERT(file, "could not write synthetic level");
+
+    fprintf(file, "[WALLS]\n");
+    for (int gz = 0; gz < size; gz++)
+    {
+        for (int gx = 0; gx < size; gx++)
+        {
+            const int base = (gz * size + gx) * 4;
+            const float x0 = gx * BENCH_CELL, x1 = x0 + BENCH_CELL;
+            const float z0 = gz * BENCH_CELL, z1 = z0 + BENCH_CELL;
+            const float corners[5][2] = {{x0, z0}, {x1, z0}, {x1, z1}, {x0, z1}, {x0, z0}};
+            const bool outer[4] = {gz == 0, gx == size - 1, gz == size - 1, gx == 0};
+
+            for (int e = 0; e < 4; e++)
+                fprintf(file, "%d %f %f %f %f %d %d 1.0 1.0 1.0\n", base + e,
+                        corners[e][0], corners[e][1], corners[e + 1][0], corners[e + 1][1], outer[e], !outer[e]);
+        }
+    }
+
+    fprintf(file, "[SECTORS]\n");
+    for (int i = 0; i < size * size; i++)
+        fprintf(file, "%d 0.8 %.1f 3.0 %d %d %d %d\n", i, 0.1f * (float) (i % 3), i * 4, i * 4 + 1, i * 4 + 2, i * 4 + 3);
+    fclose(file);
+}
+
+// The loader reports every level it reads, keep that out of the timing
+static int bench_silence(void)
+{
+    fflush(stdout);
+    const int saved = dup(STDOUT_FILENO);
+    const int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+    {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+}
+
+static void bench_restore(const int saved)
+{
+    fflush(stdout);
+    if (saved < 0) return;
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static void run_load(const bench_level_t *level, const uint64_t iterations)
+{
+    const int saved = bench_silence();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        level_t loaded = level_load_from_file(level->level.path);
+        bench_sink += loaded.sector_count;
+        level_cleanup(&loaded);
+    }
+    bench_restore(saved);
+}
+
+static void run_find_sector(const bench_level_t *level, const uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        const float *point = level->points[i % BENCH_POINTS];
+        bench_sink += (uintptr_t) level_find_player_sector(&level->level, point[0], point[1]);
+    }
+}
+
+static void run_collision(const bench_level_t *level, const uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        const float *from = level->points[i % BENCH_POINTS];
+        const float *to = level->points[(i + 1) % BENCH_POINTS];
+
+        // A short step towards the next point, about one frame of walking
+        float x = from[0] + (to[0] - from[0]) * 0.05f;
+        float z = from[1] + (to[1] - from[1]) * 0.05f;
+        bench_sink += level_check_collision(&level->level, &x, &z, from[0], from[1]);
+    }
+}
+
+static void run_point_in_polygon(const bench_level_t *level, const uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        const float *point = level->points[i % BENCH_POINTS];
+        const sector_t *sector = &level->level.sectors[i % level->level.sector_count];
+        bench_sink += point_in_polygon(point[0], point[1], sector->walls, sector->wall_count);
+    }
+}
+
+static void run_render(const bench_level_t *level, const uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        level_render(&level->level);
+        bench_sink += state.wall_vertex_count;
+    }
+}
+
+static void run_draw_string(const bench_level_t *level, const uint64_t iterations)
+{
+    (void) level;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        state.text_vertex_count = 0;
+        _draw_string("Pos: X:12.34 Z:-56.78 Y:1.50 Sector:3", -0.9f, 0.8f);
+        bench_sink += state.text_vertex_count;
+    }
+}
+
+static double time_sample(const bench_fn fn, const bench_level_t *level, const uint64_t iterations)
+{
+    const double start = VK_GETTIME();
+    fn(level, iterations);
+    return (VK_GETTIME() - start) * 1000.0;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run_benchmark(const char *name, const bench_fn fn, const bench_level_t *level)
+{
+    if (bench.filter && !strstr(name, bench.filter)) return;
+
+    uint64_t iterations = 1;
+    while (time_sample(fn, level, iterations) < BENCH_MIN_SAMPLE_MS && iterations < (1ull << 40)) iterations *= 2;
+    for (uint32_t i = 0; i < bench.warmup; i++) time_sample(fn, level, iterations);
+
+    double ns[BENCH_MAX_SAMPLES];
+    double sum = 0.0;
+    for (uint32_t i = 0; i < bench.samples; i++)
+    {
+        ns[i] = time_sample(fn, level, iterations) * 1e6 / (double) iterations;
+        sum += ns[i];
+    }
+
+    const double mean = sum / bench.samples;
+    double variance = 0.0;
+    for (uint32_t i = 0; i < bench.samples; i++) variance += (ns[i] - mean) * (ns[i] - mean);
+    const double stddev = bench.samples > 1 ? sqrt(variance / (bench.samples - 1)) : 0.0;
+
+    qsort(ns, bench.samples, sizeof(double), compare_double);
+    const double median = ns[bench.samples / 2];
+
+    printf("%-26s %-14s %10.1f ns/op  (min %.1f, max %.1f, stddev %.1f%%)\n", name, level->name, median,
+           ns[0], ns[bench.samples - 1], mean > 0.0 ? stddev / mean * 100.0 : 0.0);
+
+    fprintf(bench.out, "%s    {\"name\": \"%s\", \"level\": \"%s\", \"sectors\": %u, \"iterations\": %llu, \"samples\": %u, "
+                       "\"ns_per_op\": {\"median\": %.3f, \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"stddev\": %.3f}}",
+            bench.first_result ? "" : ",\n", name, level->name, level->level.sector_count,
+            (unsigned long long) iterations, bench.samples, median, mean, ns[0], ns[bench.samples - 1], stddev);
+    bench.first_result = false;
+}
+
+static void run_level(bench_level_t *level)
+{
+    if (!level->level.sector_count)
+    {
+        fprintf(stderr, "Warning: Skipping %s, it has no sectors\n", level->name);
+        return;
+    }
+    bench_prepare(level);
+
+    run_benchmark("level_load_from_file", run_load, level);
+    run_benchmark("level_find_player_sector", run_find_sector, level);
+    run_benchmark("level_check_collision", run_collision, level);
+    run_benchmark("point_in_polygon", run_point_in_polygon, level);
+    run_benchmark("level_render", run_render, level);
+}
+
+void INPUT() {}
+void RENDER() {}
+
+void RUN()
+{
+    bench.out = fopen(bench.out_path, "w");
+    ASSERT(bench.out, "could not write benchmark results");
+    fprintf(bench.out, "{\n  \"samples\": %u,\n  \"warmup\": %u,\n  \"results\": [\n", bench.samples, bench.warmup);
+
+    // Holds BENCH_POINTS sample points, too big to want on the stack
+    static bench_level_t level;
+
+    const char *shipped[] = {"Engine/res/level.txt", "Engine/res/backup.txt"};
+    for (size_t i = 0; i < sizeof(shipped) / sizeof(shipped[0]); i++)
+    {
+        const int saved = bench_silence();
+        level = (bench_level_t){.name = strrchr(shipped[i], '/') + 1, .level = level_load_from_file(shipped[i])};
+        bench_restore(saved);
+        run_level(&level);
+        level_cleanup(&level.level);
+    }
+
+    for (size_t i = 0; i < sizeof(synthetic_sizes) / sizeof(synthetic_sizes[0]); i++)
+    {
+        static char name[32], path[64];
+        snprintf(name, sizeof(name), "grid_%dx%d", synthetic_sizes[i], synthetic_sizes[i]);
+        snprintf(path, sizeof(path), "bench_%s.txt", name);
+        write_synthetic_level(path, synthetic_sizes[i]);
+
+        const int saved = bench_silence();
+        level = (bench_level_t){.name = name, .level = level_load_from_file(path)};
+        bench_restore(saved);
+        run_level(&level);
+        level_cleanup(&level.level);
+        remove(path);
+    }
+
+    // Glyph generation does not depend on the level, time it once
+    static bench_level_t no_level = {.name = "-"};
+    run_benchmark("_draw_string", run_draw_string, &no_level);
+
+    fprintf(bench.out, "\n  ]\n}\n");
+    fclose(bench.out);
+    printf("Results written to %s\n", bench.out_path);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) bench.out_path = argv[++i];
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) bench.samples = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) bench.warmup = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) bench.filter = argv[++i];
+        else fprintf(stderr, "Warning: Unknown argument %s\n", argv[i]);
+    }
+    if (bench.samples == 0) bench.samples = 1;
+    if (bench.samples > BENCH_MAX_SAMPLES) bench.samples = BENCH_MAX_SAMPLES;
+
+    RUN();
+    return 0;
+}
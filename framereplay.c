@@ -0,0 +1,341 @@
+#include "Engine/App.h"
+#include "Engine/util.h"
+
+// Plays back frames written with --capture on a headless device, without the game loop
+//
+//   framereplay FILE [--frames N] [--trace FILE] [--frames-csv FILE] ...
+//
+// Every captured frame is re-issued in turn until --frames (default REPLAY_DEFAULT_FRAMES) is reached,
+// the engine's frame timing, GPU scopes and traces work as in the game. A capture taken with
+// --depth-prepass binds the pre-pass pipeline variants, so it needs --depth-prepass here too.
+
+#define REPLAY_DEFAULT_FRAMES 600
+
+typedef struct
+{
+    capture_record_type_t type;
+    const pipeline_t *pipeline;
+    capture_set_kind_t set_kind;
+    texture_handle_t texture;
+    const void *data;
+    const float *view_proj;
+    uint32_t a;
+    uint32_t b;
+} captured_command_t;
+
+typedef struct
+{
+    const vertex_t *text_vertices;
+    uint32_t text_vertex_count;
+    const vertex_t *wall_vertices;
+    uint32_t wall_vertex_count;
+    uint32_t first_command;
+    uint32_t command_count;
+} captured_frame_t;
+
+static const char *captured_path;
+static uint8_t *captured_data;
+static captured_command_t *captured_commands;
+static uint32_t captured_command_count;
+static captured_frame_t *captured_frames;
+static uint32_t captured_frame_count;
+static uint32_t current_frame;
+
+static const pipeline_t* captured_pipeline(const uint32_t id)
+{
+    switch (id)
+    {
+        case CAPTURE_PIPELINE_COLORED: return &state.v.colored_pipeline;
+        case CAPTURE_PIPELINE_TEXT: return &state.v.text_pipeline;
+        case CAPTURE_PIPELINE_LEVEL: return &state.v.level_pipeline;
+        case CAPTURE_PIPELINE_INSTANCED: return &state.v.instanced_pipeline;
+        default: return &state.v.textured_pipeline;
+    }
+}
+
+static const mesh_buffer_t* captured_buffer(const uint32_t id)
+{
+    switch (id)
+    {
+        case CAPTURE_BUFFER_TEXT: return &state.v.text_buffer;
+        case CAPTURE_BUFFER_WALL: return &state.v.wall_buffer;
+        default: return &state.v.cube_buffer;
+    }
+}
+
+// Bindless slots are handed out in load order, so map the captured materials to the ones this run got
+static void remap_materials(vertex_t *vertices, const uint32_t count, const uint32_t *materials, const uint32_t material_count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        if (vertices[i].material < material_count) vertices[i].material = materials[vertices[i].material];
+}
+
+static void load_capture(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    ASSERT(file, "could not open capture");
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint32_t header[3];
+    ASSERT(file_size > (long) sizeof(header) && fread(header, sizeof(header), 1, file) == 1, "capture is truncated");
+    ASSERT(header[0] == CAPTURE_MAGIC, "not a capture file");
+    ASSERT(header[1] == CAPTURE_VERSION, "capture was written by a different engine version");
+
+    const size_t size = (size_t) file_size - sizeof(header);
+    captured_data = malloc(size);
+    ASSERT(captured_data && fread(captured_data, 1, size, file) == size, "failed to read capture");
+    fclose(file);
+
+    captured_frames = calloc(header[2], sizeof(captured_frame_t));
+    captured_commands = malloc(sizeof(captured_command_t) * (size / sizeof(capture_record_t) + 1));
+    ASSERT(captured_frames && captured_commands, "failed to allocate capture frames");
+
+    uint32_t materials[MAX_BINDLESS_TEXTURES];
+    captured_frame_t *frame = NULL;
+    vertex_t *wall_vertices = NULL;
+
+    for (size_t offset = 0; offset + sizeof(capture_record_t) <= size;)
+    {
+        const capture_record_t *record = (const capture_record_t *) (captured_data + offset);
+        uint8_t *payload = captured_data + offset + sizeof(capture_record_t);
+        offset += sizeof(capture_record_t) + record->size;
+        ASSERT(offset <= size, "capture record runs past the end of the file");
+
+        if (record->type == CAPTURE_FRAME_BEGIN)
+        {
+            ASSERT(captured_frame_count < header[2], "capture has more frames than its header says");
+            frame = &captured_frames[captured_frame_count++];
+            frame->first_command = captured_command_count;
+            for (uint32_t i = 0; i < MAX_BINDLESS_TEXTURES; i++) materials[i] = i;
+            continue;
+        }
+        ASSERT(frame, "capture record outside of a frame");
+
+        switch (record->type)
+        {
+            case CAPTURE_FRAME_END:
+                if (wall_vertices) remap_materials(wall_vertices, frame->wall_vertex_count, materials, MAX_BINDLESS_TEXTURES);
+                wall_vertices = NULL;
+                frame = NULL;
+                break;
+
+            case CAPTURE_TEXTURE:
+            {
+                const capture_texture_t *texture = (const capture_texture_t *) payload;
+                const char *texture_path = (const char *) (texture + 1);
+                const texture_handle_t handle = vk_texture_handle(texture_path, (texture_flags_t) texture->flags);
+                if (texture->material < MAX_BINDLESS_TEXTURES) materials[texture->material] = vk_texture_material(handle);
+                break;
+            }
+
+            case CAPTURE_VERTICES:
+            {
+                const capture_vertices_t *vertices = (const capture_vertices_t *) payload;
+                vertex_t *data = (vertex_t *) (vertices + 1);
+                if (vertices->buffer == CAPTURE_BUFFER_TEXT)
+                {
+                    frame->text_vertices = data;
+                    frame->text_vertex_count = vertices->count < MAX_TEXT_VERTICES ? vertices->count : MAX_TEXT_VERTICES;
+                }
+                else if (vertices->buffer == CAPTURE_BUFFER_WALL)
+                {
+                    frame->wall_vertices = wall_vertices = data;
+                    frame->wall_vertex_count = vertices->count < MAX_WALL_VERTICES ? vertices->count : MAX_WALL_VERTICES;
+                }
+                break;
+            }
+
+            default:
+            {
+                captured_command_t *command = &captured_commands[captured_command_count++];
+                *command = (captured_command_t){.type = record->type};
+                const uint32_t *words = (const uint32_t *) payload;
+
+                if (record->type == CAPTURE_BIND_PIPELINE)
+                {
+                    const capture_bind_pipeline_t *bind = (const capture_bind_pipeline_t *) payload;
+                    command->pipeline = captured_pipeline(bind->pipeline);
+                    command->a = bind->variant;
+
+                    // Caught here rather than by the bind's assert halfway through a replayed frame
+                    ASSERT(bind->variant <= PIPELINE_VARIANT_EQUAL, "capture binds an unknown pipeline variant");
+                    ASSERT(bind->variant == PIPELINE_VARIANT_DEFAULT || config.depth_prepass,
+                           "capture was taken with --depth-prepass, replay it with --depth-prepass");
+                    ASSERT(bind->variant != PIPELINE_VARIANT_PREPASS || command->pipeline->prepass,
+                           "capture binds a pre-pass variant its pipeline lacks");
+                    ASSERT(bind->variant != PIPELINE_VARIANT_EQUAL || command->pipeline->equal,
+                           "capture binds an equal-depth variant its pipeline lacks");
+                }
+                else if (record->type == CAPTURE_BIND_SET)
+                {
+                    const capture_set_t *set = (const capture_set_t *) payload;
+                    command->pipeline = captured_pipeline(set->pipeline);
+                    command->set_kind = (capture_set_kind_t) set->kind;
+                    if (set->kind == CAPTURE_SET_TEXTURE)
+                        command->texture = vk_texture_handle((const char *) (set + 1), (texture_flags_t) set->flags);
+                }
+                else if (record->type == CAPTURE_DRAW_UNIFORMS)
+                {
+                    ASSERT(record->size >= sizeof(uint32_t) + sizeof(draw_uniforms_t), "truncated draw uniforms record");
+                    command->pipeline = captured_pipeline(words[0]);
+                    command->data = words + 1;
+                }
+                else if (record->type == CAPTURE_CAMERA)
+                {
+                    ASSERT(record->size >= sizeof(camera_uniforms_t), "truncated camera record");
+                    command->data = payload;
+                }
+                else if (record->type == CAPTURE_BIND_VERTICES) command->a = words[0];
+                else if (record->type == CAPTURE_DRAW)
+                {
+                    const capture_draw_t *draw = (const capture_draw_t *) payload;
+                    command->a = draw->vertex_count;
+                    command->b = draw->first_vertex;
+                }
+                else if (record->type == CAPTURE_DRAW_INSTANCES)
+                {
+                    const capture_instances_t *instances = (const capture_instances_t *) payload;
+                    command->data = instances + 1;
+                    command->view_proj = instances->view_proj;
+                    command->a = instances->vertex_count;
+                    command->b = instances->instance_count;
+                }
+                else if (record->type == CAPTURE_SCOPE_BEGIN) command->data = payload;
+
+                frame->command_count = captured_command_count - frame->first_command;
+                break;
+            }
+        }
+    }
+
+    ASSERT(captured_frame_count > 0, "capture holds no frames");
+    printf("Loaded %u captured frames, %u commands from %s\n", captured_frame_count, captured_command_count, path);
+}
+
+void RUN()
+{
+    // Textures resolve through the registry, so the capture can only be read once the device exists,
+    // and a capture may name any engine resource, so --lazy-init has nothing to hold back here
+    VK_START();
+    vk_load_deferred();
+    load_capture(captured_path);
+
+    while (VK_FRAME()) {}
+
+    VK_END();
+    free(captured_commands);
+    free(captured_frames);
+    free(captured_data);
+
+    for (uint32_t i = 0; i < state.gpu_scope_count; i++)
+    {
+        const gpu_scope_t *scope = &state.gpu_scopes[i];
+        if (scope->has_stats)
+            printf("GPU %*s%s: %.3fms VS:%llu FS:%llu\n", (int) scope->depth * 2, "", scope->name, scope->ms,
+                   (unsigned long long) scope->stats[GPU_STAT_VERTEX_INVOCATIONS],
+                   (unsigned long long) scope->stats[GPU_STAT_FRAGMENT_INVOCATIONS]);
+        else printf("GPU %*s%s: %.3fms\n", (int) scope->depth * 2, "", scope->name, scope->ms);
+    }
+}
+
+// Stage the next captured frame's vertex data, VK_FRAME uploads it right after INPUT
+void INPUT()
+{
+    current_frame = (uint32_t) (state.v.frameIndex % captured_frame_count);
+    const captured_frame_t *frame = &captured_frames[current_frame];
+
+    memcpy(state.text_vertices, frame->text_vertices, sizeof(vertex_t) * frame->text_vertex_count);
+    state.text_vertex_count = frame->text_vertex_count;
+    memcpy(state.wall_vertices, frame->wall_vertices, sizeof(vertex_t) * frame->wall_vertex_count);
+    state.wall_vertex_count = frame->wall_vertex_count;
+}
+
+void RENDER()
+{
+    const captured_frame_t *frame = &captured_frames[current_frame];
+    for (uint32_t i = 0; i < frame->command_count; i++)
+    {
+        const captured_command_t *command = &captured_commands[frame->first_command + i];
+        switch (command->type)
+        {
+            case CAPTURE_BIND_PIPELINE:
+                vk_cmd_bind_pipeline_variant(command->pipeline, (pipeline_variant_t) command->a);
+                break;
+
+            case CAPTURE_BIND_SET:
+            {
+                VkDescriptorSet set = VK_NULL_HANDLE;
+                if (command->set_kind == CAPTURE_SET_TEXTURE) set = vk_texture_bind(command->texture, NULL);
+                else if (command->set_kind == CAPTURE_SET_FONT) set = font_descriptor_set;
+                else if (command->set_kind == CAPTURE_SET_BOARD) set = board_descriptor_set;
+                else if (command->set_kind == CAPTURE_SET_BINDLESS) set = state.v.bindlessSet;
+                if (set) vk_cmd_bind_set(command->pipeline, set);
+                break;
+            }
+
+            case CAPTURE_DRAW_UNIFORMS:
+            {
+                draw_uniforms_t uniforms;
+                memcpy(&uniforms, command->data, sizeof(uniforms));
+                vk_cmd_draw_uniforms(command->pipeline, &uniforms);
+                break;
+            }
+
+            case CAPTURE_CAMERA:
+            {
+                camera_uniforms_t camera;
+                memcpy(&camera, command->data, sizeof(camera));
+                vk_set_camera(&camera);
+                break;
+            }
+
+            case CAPTURE_BIND_VERTICES:
+                vk_cmd_bind_vertices(captured_buffer(command->a));
+                break;
+
+            case CAPTURE_DRAW:
+                vk_cmd_draw(command->a, command->b);
+                break;
+
+            case CAPTURE_DRAW_INSTANCES:
+            {
+                mat4 view_proj;
+                memcpy(view_proj, command->view_proj, sizeof(mat4));
+                vk_cmd_draw_instances(command->a, command->data, command->b, view_proj);
+                break;
+            }
+
+            case CAPTURE_SCOPE_BEGIN:
+                VK_GPU_SCOPE_BEGIN((const char *) command->data);
+                break;
+
+            case CAPTURE_SCOPE_END:
+                VK_GPU_SCOPE_END();
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+// The capture comes first, everything after it goes to the engine
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: %s FILE [--frames N] [engine options]\n", argv[0]);
+        return 1;
+    }
+    captured_path = argv[1];
+    argv[1] = argv[0];
+
+    VK_ARGS(argc - 1, argv + 1);
+    config.headless = true;
+    if (!config.max_frames && config.max_seconds <= 0.0) config.max_frames = REPLAY_DEFAULT_FRAMES;
+
+    RUN();
+    return state.exit_code;
+}
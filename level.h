@@ -9,7 +9,8 @@ typedef struct
     vec3 color;
     bool is_solid;
     bool is_invisible;
-    const char* texture_path;
+    const char* texture_path; // NULL uses the texture bound by VK_TEXTURE_HANDLE
+    uint32_t texture;         // registry handle, resolved from texture_path on first render
 } wall_t;
 
 typedef struct
@@ -27,6 +28,8 @@ typedef struct
     const char* path;
     sector_t *sectors;
     uint32_t sector_count;
+    char **texture_paths;     // interned, walls point into this table
+    uint32_t texture_path_count;
 } level_t;
 
 #endif
@@ -51,6 +54,12 @@ void level_cleanup(level_t *level)
         level->sectors = NULL;
     }
     level->sector_count = 0;
+
+    for (uint32_t i = 0; i < level->texture_path_count; i++)
+        free(level->texture_paths[i]);
+    free(level->texture_paths);
+    level->texture_paths = NULL;
+    level->texture_path_count = 0;
 }
 
 static bool point_in_polygon(const float px, const float pz, const wall_t *walls, const uint32_t wall_count)
@@ -85,7 +94,8 @@ sector_t* level_find_player_sector(const level_t *level, const float px, const f
 static void add_wall_quad(const float x1, const float z1,
                           const float x2, const float z2,
                           const float bottom, const float top,
-                          const vec4 color, const float u_scale)
+                          const vec4 color, const float u_scale,
+                          const uint32_t material)
 {
     if (state.wall_vertex_count + 6 > MAX_WALL_VERTICES)
         return;
@@ -97,23 +107,23 @@ static void add_wall_quad(const float x1, const float z1,
     const float v_max = top - bottom;
 
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x1, bottom, z1}, {0.0f, 0.0f}, {color[0], color[1], color[2], color[3]}
+            {x1, bottom, z1}, {0.0f, 0.0f}, {color[0], color[1], color[2], color[3]}, material
     };
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x2, top, z2}, {u_max, v_max}, {color[0], color[1], color[2], color[3]}
+            {x2, top, z2}, {u_max, v_max}, {color[0], color[1], color[2], color[3]}, material
     };
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x2, bottom, z2}, {u_max, 0.0f}, {color[0], color[1], color[2], color[3]}
+            {x2, bottom, z2}, {u_max, 0.0f}, {color[0], color[1], color[2], color[3]}, material
     };
 
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x1, bottom, z1}, {0.0f, 0.0f}, {color[0], color[1], color[2], color[3]}
+            {x1, bottom, z1}, {0.0f, 0.0f}, {color[0], color[1], color[2], color[3]}, material
     };
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x1, top, z1}, {0.0f, v_max}, {color[0], color[1], color[2], color[3]}
+            {x1, top, z1}, {0.0f, v_max}, {color[0], color[1], color[2], color[3]}, material
     };
     state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
-            {x2, top, z2}, {u_max, v_max}, {color[0], color[1], color[2], color[3]}
+            {x2, top, z2}, {u_max, v_max}, {color[0], color[1], color[2], color[3]}, material
     };
 }
 
@@ -136,6 +146,14 @@ static const sector_t* find_adjacent_sector(const level_t *level, const sector_t
     return NULL;
 }
 
+// Only the bindless path samples per-wall textures, the fallback draws every wall with the bound one
+static uint32_t wall_material(wall_t *wall)
+{
+    if (!wall->texture_path || !state.v.bindless) return current_material;
+    if (!wall->texture) wall->texture = vk_texture_handle(wall->texture_path, TEXTURE_MIPMAPPED);
+    return vk_texture_material(wall->texture);
+}
+
 static void render_sector(const level_t *level, const sector_t *sector)
 {
     const vec4 floor_color = {
@@ -154,7 +172,8 @@ static void render_sector(const level_t *level, const sector_t *sector)
 
     for (uint32_t i = 0; i < sector->wall_count; i++)
     {
-        const wall_t *wall = &sector->walls[i];
+        wall_t *wall = &sector->walls[i];
+        const uint32_t material = wall_material(wall);
 
         {
             const vec4 wall_color = {
@@ -172,7 +191,8 @@ static void render_sector(const level_t *level, const sector_t *sector)
                     sector->floor_height,
                     sector->ceil_height,
                     wall_color,
-                    1.0f
+                    1.0f,
+                    material
                 );
             }
             else
@@ -192,7 +212,8 @@ static void render_sector(const level_t *level, const sector_t *sector)
                             f_bottom,
                             f_top,
                             wall_color,
-                            1.0f
+                            1.0f,
+                            material
                         );
                     }
 
@@ -206,7 +227,8 @@ static void render_sector(const level_t *level, const sector_t *sector)
                             c_bottom,
                             c_top,
                             wall_color,
-                            1.0f
+                            1.0f,
+                            material
                         );
                     }
                 }
@@ -221,47 +243,95 @@ static void render_sector(const level_t *level, const sector_t *sector)
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {sector->walls[0].x1, sector->floor_height, sector->walls[0].z1},
                             {sector->walls[0].x1, sector->walls[0].z1},
-                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]}
+                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]},
+                            current_material
                 };
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {wall->x1, sector->floor_height, wall->z1},
                             {wall->x1, wall->z1},
-                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]}
+                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]},
+                            current_material
                 };
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {wall->x2, sector->floor_height, wall->z2},
                             {wall->x2, wall->z2},
-                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]}
+                            {floor_color[0], floor_color[1], floor_color[2], floor_color[3]},
+                            current_material
                 };
 
                 // Ceil
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {sector->walls[0].x1, sector->ceil_height, sector->walls[0].z1},
                             {sector->walls[0].x1, sector->walls[0].z1},
-                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]}
+                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]},
+                            current_material
                 };
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {wall->x2, sector->ceil_height, wall->z2},
                             {wall->x2, wall->z2},
-                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]}
+                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]},
+                            current_material
                 };
                 state.wall_vertices[state.wall_vertex_count++] = (vertex_t){
                             {wall->x1, sector->ceil_height, wall->z1},
                             {wall->x1, wall->z1},
-                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]}
+                            {ceil_color[0], ceil_color[1], ceil_color[2], ceil_color[3]},
+                            current_material
                 };
             }
         }
     }
 }
 
+typedef struct
+{
+    float distance; // squared, from the camera to the average of the wall start points
+    uint32_t index;
+} sector_order_t;
+
+static int compare_sector_order(const void *a, const void *b)
+{
+    const float da = ((const sector_order_t *) a)->distance;
+    const float db = ((const sector_order_t *) b)->distance;
+    return (da > db) - (da < db);
+}
+
+// The walls are one draw, so vertex order is raster order: emitting the sectors nearest the camera first
+// lets the depth test reject most of what they hide before it is shaded
 void level_render(const level_t *level)
 {
+    static sector_order_t *order;
+    static uint32_t order_capacity;
+
     state.wall_vertex_count = 0;
+    if (level->sector_count > order_capacity)
+    {
+        order = realloc(order, sizeof(sector_order_t) * level->sector_count);
+        ASSERT(order, "failed to grow sector order");
+        order_capacity = level->sector_count;
+    }
 
     for (uint32_t i = 0; i < level->sector_count; i++)
     {
-        render_sector(level, &level->sectors[i]);
+        const sector_t *sector = &level->sectors[i];
+        float x = 0.0f, z = 0.0f;
+        for (uint32_t w = 0; w < sector->wall_count; w++)
+        {
+            x += sector->walls[w].x1;
+            z += sector->walls[w].z1;
+        }
+        if (sector->wall_count)
+        {
+            x = x / (float) sector->wall_count - state.cam.x;
+            z = z / (float) sector->wall_count - state.cam.z;
+        }
+        order[i] = (sector_order_t){.distance = x * x + z * z, .index = i};
+    }
+    qsort(order, level->sector_count, sizeof(sector_order_t), compare_sector_order);
+
+    for (uint32_t i = 0; i < level->sector_count; i++)
+    {
+        render_sector(level, &level->sectors[order[i].index]);
     }
 }
 
@@ -333,10 +403,12 @@ level_t level_load_from_file(const char* filepath)
         .name = "LOADED",
         .path = filepath,
         .sectors = NULL,
-        .sector_count = 0
+        .sector_count = 0,
+        .texture_paths = NULL,
+        .texture_path_count = 0
     };
 
-    FILE* file = fopen(filepath, "r");
+    FILE* file = pack_fopen(filepath);
     if (!file) {
         fprintf(stderr, "ERROR: Could not open level file: %s\n", filepath);
         return level;
@@ -345,9 +417,11 @@ level_t level_load_from_file(const char* filepath)
     char line[512];
     enum { NONE, WALLS, SECTORS } section = NONE;
 
-    // Temporary storage for walls (max 256 walls)
-    #define MAX_TEMP_WALLS 256
-    wall_t temp_walls[MAX_TEMP_WALLS];
+    // Temporary storage for walls, indexed by id and grown as ids come in
+    #define MAX_LEVEL_WALLS (1 << 20)
+    #define MAX_SECTOR_WALLS 256
+    wall_t *temp_walls = NULL;
+    int temp_wall_capacity = 0;
     int wall_count = 0;
 
     while (fgets(line, sizeof(line), file)) {
@@ -368,10 +442,32 @@ level_t level_load_from_file(const char* filepath)
             int id, is_solid, is_inv = 0;
             float x1, z1, x2, z2;
             float r = 1.0f, g = 1.0f, b = 1.0f;
+            char texture[256];
 
-            const int read = sscanf(line, "%d %f %f %f %f %d %d %f %f %f", &id, &x1, &z1, &x2, &z2, &is_solid, &is_inv, &r, &g, &b);
+            const int read = sscanf(line, "%d %f %f %f %f %d %d %f %f %f %255s", &id, &x1, &z1, &x2, &z2, &is_solid, &is_inv, &r, &g, &b, texture);
             if (read >= 6) {
-                if (id >= 0 && id < MAX_TEMP_WALLS) {
+                if (id >= 0 && id < MAX_LEVEL_WALLS) {
+                    if (id >= temp_wall_capacity) {
+                        int capacity = temp_wall_capacity ? temp_wall_capacity : 256;
+                        while (capacity <= id) capacity *= 2;
+                        temp_walls = realloc(temp_walls, sizeof(wall_t) * capacity);
+                        ASSERT(temp_walls, "failed to grow level wall table");
+                        memset(temp_walls + temp_wall_capacity, 0, sizeof(wall_t) * (capacity - temp_wall_capacity));
+                        temp_wall_capacity = capacity;
+                    }
+
+                    // Intern the texture path so every wall using it shares one string
+                    const char *texture_path = NULL;
+                    if (read >= 11) {
+                        for (uint32_t i = 0; i < level.texture_path_count && !texture_path; i++)
+                            if (strcmp(level.texture_paths[i], texture) == 0) texture_path = level.texture_paths[i];
+                        if (!texture_path) {
+                            level.texture_paths = realloc(level.texture_paths, sizeof(char *) * (level.texture_path_count + 1));
+                            level.texture_paths[level.texture_path_count] = strdup(texture);
+                            texture_path = level.texture_paths[level.texture_path_count++];
+                        }
+                    }
+
                     temp_walls[id] = (wall_t){
                         .id = id,
                         .x1 = x1, .z1 = z1,
@@ -379,7 +475,8 @@ level_t level_load_from_file(const char* filepath)
                         .color = {r, g, b},
                         .is_solid = (is_solid != 0),
                         .is_invisible = (read >= 7 && is_inv != 0),
-                        .texture_path = NULL
+                        .texture_path = texture_path,
+                        .texture = 0
                     };
                     if (id >= wall_count) wall_count = id + 1;
                 }
@@ -403,12 +500,12 @@ level_t level_load_from_file(const char* filepath)
                 }
 
                 // Count wall IDs
-                int wall_ids[MAX_TEMP_WALLS];
+                int wall_ids[MAX_SECTOR_WALLS];
                 int wall_id_count = 0;
                 int wall_id;
                 int n;
 
-                while (sscanf(ptr, "%d%n", &wall_id, &n) == 1) {
+                while (wall_id_count < MAX_SECTOR_WALLS && sscanf(ptr, "%d%n", &wall_id, &n) == 1) {
                     wall_ids[wall_id_count++] = wall_id;
                     ptr += n;
                 }
@@ -459,6 +556,7 @@ level_t level_load_from_file(const char* filepath)
     }
 
     fclose(file);
+    free(temp_walls);
     printf("Loaded level: %d sectors, %d walls\n", level.sector_count, wall_count);
     return level;
 }
@@ -4,14 +4,91 @@
 #define LEVEL_RENDERING
 #include "level.h"
 
+typedef struct
+{
+    const char *path;
+    level_t level;
+} level_task_t;
+
+static void load_level_task(void *user)
+{
+    level_task_t *task = user;
+    task->level = level_load_from_file(task->path);
+}
+
+#define CUBE_FIELD_SPACING 1.5f
+#define CUBE_SLICE_INSTANCES 8192 // per queued draw and cull batch
+#define CUBE_SLICES (MAX_CUBE_INSTANCES / CUBE_SLICE_INSTANCES)
+static cube_instance_t *cube_field;
+static uint32_t cube_field_count;
+static vec3 cube_slice_centers[CUBE_SLICES]; // mean instance position of each slice's range
+
+// Resolved once in RUN, RENDER binds the handles without touching the paths
+static texture_handle_t checker_texture;
+static texture_handle_t font_texture;
+
+// --cubes, a square grid around the spawn point to stress instanced drawing
+static void build_cube_field(const uint32_t count)
+{
+    cube_field_count = count < MAX_CUBE_INSTANCES ? count : MAX_CUBE_INSTANCES;
+    cube_field = malloc(sizeof(cube_instance_t) * cube_field_count);
+    ASSERT(cube_field, "failed to allocate cube field");
+
+    const uint32_t side = (uint32_t) ceilf(sqrtf((float) cube_field_count));
+    const float origin = -0.5f * CUBE_FIELD_SPACING * (float) (side - 1);
+    for (uint32_t i = 0; i < cube_field_count; i++)
+    {
+        const float u = (float) (i % side) / (float) side;
+        const float v = (float) (i / side) / (float) side;
+        cube_field[i] = (cube_instance_t){
+            .position = {origin + CUBE_FIELD_SPACING * (float) (i % side), 0.25f, origin + CUBE_FIELD_SPACING * (float) (i / side)},
+            .rotation = {0.0f, (float) i * 0.37f, 0.0f},
+            .scale = {0.5f, 0.5f, 0.5f},
+            .color = {0.5f + 0.5f * u, 0.5f + 0.5f * v, 1.0f - 0.5f * u, 1.0f}
+        };
+        glm_vec3_add(cube_slice_centers[i / CUBE_SLICE_INSTANCES], cube_field[i].position, cube_slice_centers[i / CUBE_SLICE_INSTANCES]);
+    }
+    for (uint32_t first = 0; first < cube_field_count; first += CUBE_SLICE_INSTANCES)
+    {
+        const uint32_t left = cube_field_count - first;
+        const float count = (float) (left < CUBE_SLICE_INSTANCES ? left : CUBE_SLICE_INSTANCES);
+        glm_vec3_divs(cube_slice_centers[first / CUBE_SLICE_INSTANCES], count, cube_slice_centers[first / CUBE_SLICE_INSTANCES]);
+    }
+    printf("Cube field: %u instances\n", cube_field_count);
+}
+
+// One instanced draw and cull batch per slice, queued at its centre's distance so the queue's sort
+// draws the slices front to back. Only copies instances, so slices can be queued from any thread.
+static void queue_cube_slice(void *user, const uint32_t slice)
+{
+    const uint32_t first = slice * CUBE_SLICE_INSTANCES;
+    const uint32_t left = cube_field_count - first;
+    vec3 eye = {state.cam.x, state.cam.y, state.cam.z};
+
+    current_texture = *(const VkDescriptorSet *) user;
+    VK_TINT(1.0f, 1.0f, 1.0f, 1.0f);
+    VK_TILETEXTURE(1.0f);
+    VK_DRAWCUBES(cube_field + first, left < CUBE_SLICE_INSTANCES ? left : CUBE_SLICE_INSTANCES,
+                 glm_vec3_distance(cube_slice_centers[slice], eye));
+}
+
 void RUN()
 {
+    // Parsing needs no device, so the levels load on the job pool while VK_START brings Vulkan up
+    level_task_t level_tasks[] = {{"Engine/res/level.txt"}, {"Engine/res/backup.txt"}};
+    const int level_task_count = (int) (sizeof(level_tasks) / sizeof(level_tasks[0]));
+    ASSERT(level_task_count <= MAX_LEVELS, "too many levels loaded");
+    job_t level_jobs[MAX_LEVELS];
+    for (int i = 0; i < level_task_count; i++) level_jobs[i] = job_add("load_level", load_level_task, &level_tasks[i], NULL, 0);
+
     VK_START();
 
     state.level_count = 0;
-    state.levels[state.level_count++] = level_load_from_file("Engine/res/level.txt");
-    state.levels[state.level_count++] = level_load_from_file("Engine/res/backup.txt");
-    ASSERT(state.level_count <= MAX_LEVELS, "too many levels loaded");
+    for (int i = 0; i < level_task_count; i++)
+    {
+        jobs_wait(level_jobs[i]);
+        state.levels[state.level_count++] = level_tasks[i].level;
+    }
     
     state.level_id = 0;
 
@@ -20,14 +97,21 @@ void RUN()
     state.cam.z = 0.0f;
     state.cam.yaw = 0.0f;
     state.current_sector = level_find_player_sector(&state.levels[state.level_id], state.cam.x, state.cam.z);
+    if (config.cubes) build_cube_field(config.cubes);
+
+    checker_texture = VK_TEXTURE_MIPMAPPED("Engine/res/checker.png");
+    font_texture = VK_TEXTURE("Engine/res/font.png");
 
     while (VK_FRAME())
     {
+        VK_ZONE_BEGIN("collision");
         const float old_x = state.cam.x;
         const float old_z = state.cam.z;
         level_check_collision(&state.levels[state.level_id], &state.cam.x, &state.cam.z, old_x, old_z);
         state.current_sector = level_find_player_sector(&state.levels[state.level_id], state.cam.x, state.cam.z);
+        VK_ZONE_END();
 
+        VK_ZONE_BEGIN("hud");
         VK_BEGINTEXT;
         VK_DRAWTEXT(-0.9f, -0.9f, "Doom Demo");
         VK_DRAWTEXTF(-0.9f, 0.9f, "FPS:%.0f", state.fps);
@@ -35,106 +119,145 @@ void RUN()
         if (state.current_sector) VK_DRAWTEXTF(-0.9f, 0.7f, "Sector:%i Light:%.2f", state.current_sector->id, state.current_sector->light_intensity);
         else VK_DRAWTEXT(-0.9f, 0.7f, "Sector:NO_LEVEL_FOUND");
         VK_DRAWTEXTF(-0.9f, 0.6f, "Level:%d", state.level_id);
+
+        VK_DRAWTEXTF(-0.9f, 0.5f, "CPU:%.2fms GPU:%.2fms", state.cpu_frame_ms, state.gpu_frame_ms);
+        if (cube_field_count) VK_DRAWTEXTF(-0.9f, -0.6f, "Cubes:%u of %u visible", state.instances_visible, state.instances_drawn);
+        VK_DRAWTEXTF(-0.9f, -0.5f, "Draws:%u (%u queued) binds: pipeline %u set %u",
+                     state.draw_calls, state.queued_draws, state.pipeline_binds, state.set_binds);
+        if (state.v.offscreen)
+            VK_DRAWTEXTF(-0.9f, -0.4f, "Scale:%.0f%% %ux%u", state.render_scale * 100.0f,
+                         state.v.sceneExtent.width, state.v.sceneExtent.height);
+
+        const frame_times_t *times = &state.frame_times;
+        if (state.pace_fps > 0.0)
+            VK_DRAWTEXTF(-0.9f, -0.3f, "Present:%s cap:%.0ffps jitter:%.2fms", state.present_mode, state.pace_fps, times->jitter);
+        else VK_DRAWTEXTF(-0.9f, -0.3f, "Present:%s uncapped jitter:%.2fms", state.present_mode, times->jitter);
+        VK_DRAWTEXTF(-0.9f, -0.7f, "Frame p50:%.1f p95:%.1f p99:%.1f max:%.1f hitches:%u",
+                     times->cpu.p50, times->cpu.p95, times->cpu.p99, times->cpu.max, times->cpu.hitches);
+        if (times->gpu.max > 0.0)
+            VK_DRAWTEXTF(-0.9f, -0.8f, "GPU p50:%.1f p95:%.1f p99:%.1f max:%.1f",
+                         times->gpu.p50, times->gpu.p95, times->gpu.p99, times->gpu.max);
+        for (uint32_t i = 0; i < state.gpu_scope_count; i++)
+        {
+            const gpu_scope_t *scope = &state.gpu_scopes[i];
+            const float x = -0.85f + 0.05f * (float) scope->depth;
+            const float y = 0.4f - 0.1f * (float) i;
+            if (scope->has_stats)
+                VK_DRAWTEXTF(x, y, "%s:%.2fms VS:%llu FS:%llu", scope->name, scope->ms,
+                             (unsigned long long) scope->stats[GPU_STAT_VERTEX_INVOCATIONS],
+                             (unsigned long long) scope->stats[GPU_STAT_FRAGMENT_INVOCATIONS]);
+            else VK_DRAWTEXTF(x, y, "%s:%.2fms", scope->name, scope->ms);
+        }
+        for (uint32_t i = 0; i < state.cpu_zone_count; i++)
+        {
+            const cpu_zone_t *zone = &state.cpu_zones[i];
+            VK_DRAWTEXTF(0.2f + 0.05f * (float) zone->depth, 0.9f - 0.1f * (float) i, "%s:%.2fms", zone->name, zone->ms);
+        }
+        VK_ZONE_END();
     }
 
 #define END() do { VK_END(); for (int i = 0; i < state.level_count; i++) level_cleanup(&state.levels[i]); } while (0)
     END();
+    free(cube_field);
 }
 
 
 void RENDER()
 {
-    const VkDeviceSize offsets[] = {0};
-
-    // Render level geometry
+    // Render level geometry, queued like the text so VK_FRAME records both sorted once RENDER returns
     {
-        VK_TEXTURE("Engine/res/checker.png");
+        VK_TEXTURE_HANDLE(checker_texture);
         VK_TINT(1.0f, 1.0f, 1.0f, 1.0f);
         VK_TILETEXTURE(3.0f);
+        VK_ZONE_BEGIN("level_render");
         level_render(&state.levels[state.level_id]);
+        VK_ZONE_END();
 
         if (state.wall_vertex_count > 0)
         {
-            mat4 view, proj, vp;
-            glm_mat4_identity(view);
-            glm_rotate(view, state.cam.pitch, (vec3){1.0f, 0.0f, 0.0f});
-            glm_rotate(view, state.cam.yaw, (vec3){0.0f, 1.0f, 0.0f});
-            glm_translate(view, (vec3){-state.cam.x, -state.cam.y, -state.cam.z});
-
-            glm_perspective(glm_rad(FOV_DEGREES), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE, proj);
-            glm_mat4_mul(proj, view, vp);
-
-            push_constants_textured_t pc;
-            glm_mat4_copy(vp, pc.mvp);
-            glm_vec4_copy(tint, pc.tint_color);
-            pc.tiling = texture_tiling;
-
-            vkCmdBindPipeline(state.v.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state.v.textured_pipeline.pipeline);
-
-            vkCmdBindDescriptorSets(state.v.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state.v.textured_pipeline.layout, 0, 1, current_texture, 0, NULL);
-            vkCmdPushConstants(state.v.commandBuffer, state.v.textured_pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push_constants_textured_t), &pc);
-            vkCmdBindVertexBuffers(state.v.commandBuffer, 0, 1, &state.v.wall_buffer.buffer, offsets);
-            vkCmdDraw(state.v.commandBuffer, state.wall_vertex_count, 1, 0, 0);
+            // Walls are built in world space, so the camera alone places them. Bindless draws every wall
+            // material in one call, otherwise everything uses the bound texture
+            draw_packet_t packet = {
+                .pass = DRAW_PASS_OPAQUE,
+                .pipeline = state.v.bindless ? &state.v.level_pipeline : &state.v.textured_pipeline,
+                .set = state.v.bindless ? state.v.bindlessSet : current_texture,
+                .vertices = &state.v.wall_buffer,
+                .vertex_count = state.wall_vertex_count
+            };
+            glm_mat4_identity(packet.uniforms.model);
+            glm_vec4_copy(tint, packet.uniforms.tint_color);
+            packet.uniforms.tiling = texture_tiling;
+            vk_queue_draw(&packet);
         }
     }
 
+    if (cube_field_count)
+    {
+        // Queued into the opaque pass, so their GPU time shows up under its scope
+        VK_ZONE_BEGIN("queue_cubes");
+        VK_TEXTURE_HANDLE(checker_texture);
+        VkDescriptorSet texture = current_texture;
+        const uint32_t slice_count = (cube_field_count + CUBE_SLICE_INSTANCES - 1) / CUBE_SLICE_INSTANCES;
+        if (config.parallel_record) jobs_parallel_for("queue_cubes", queue_cube_slice, &texture, slice_count);
+        else for (uint32_t i = 0; i < slice_count; i++) queue_cube_slice(&texture, i);
+        VK_ZONE_END();
+    }
+
     // Render text overlay
     {
-        VK_TEXTURE("Engine/res/font.png");
+        VK_TEXTURE_HANDLE(font_texture);
         VK_TINT(1.0f, 1.0f, 0.0f, 1.0f);
-        mat4 proj;
-        glm_ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, proj);
-
-        push_constants_textured_t pc;
-        glm_mat4_copy(proj, pc.mvp);
-        glm_vec4_copy(tint, pc.tint_color);
-
-        vkCmdBindPipeline(state.v.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state.v.text_pipeline.pipeline);
-        vkCmdBindDescriptorSets(state.v.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state.v.text_pipeline.layout, 0, 1, &font_descriptor_set, 0, NULL);
-        vkCmdPushConstants(state.v.commandBuffer, state.v.text_pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push_constants_textured_t), &pc);
-        vkCmdBindVertexBuffers(state.v.commandBuffer, 0, 1, &state.v.text_buffer.buffer, offsets);
 
-        if (state.v.text_buffer.vertex_count > 0) vkCmdDraw(state.v.commandBuffer, state.v.text_buffer.vertex_count, 1, 0, 0);
+        draw_packet_t packet = {
+            .pass = DRAW_PASS_OVERLAY,
+            .pipeline = &state.v.text_pipeline,
+            .set = font_descriptor_set,
+            .vertices = &state.v.text_buffer,
+            .vertex_count = state.v.text_buffer.vertex_count
+        };
+        glm_ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, packet.uniforms.model);
+        glm_vec4_copy(tint, packet.uniforms.tint_color);
+        vk_queue_draw(&packet);
     }
 }
 
 void INPUT()
 {
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_ESCAPE) == GLFW_PRESS) END();
+    if (VK_KEYDOWN(GLFW_KEY_ESCAPE)) END();
     const float cam_speed = CAM * state.delta_time;
     const float rot_speed = ROT * state.delta_time;
 
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_LEFT) == GLFW_PRESS) state.cam.yaw -= rot_speed;
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_RIGHT) == GLFW_PRESS) state.cam.yaw += rot_speed;
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_UP) == GLFW_PRESS) state.cam.pitch += rot_speed;
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_DOWN) == GLFW_PRESS) state.cam.pitch -= rot_speed;
+    if (VK_KEYDOWN(GLFW_KEY_LEFT)) state.cam.yaw -= rot_speed;
+    if (VK_KEYDOWN(GLFW_KEY_RIGHT)) state.cam.yaw += rot_speed;
+    if (VK_KEYDOWN(GLFW_KEY_UP)) state.cam.pitch += rot_speed;
+    if (VK_KEYDOWN(GLFW_KEY_DOWN)) state.cam.pitch -= rot_speed;
 
     const vec3 forward = {sinf(state.cam.yaw), 0.0f, -cosf(state.cam.yaw)};
     const vec3 right = {cosf(state.cam.yaw), 0.0f, sinf(state.cam.yaw)};
 
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_W) == GLFW_PRESS)
+    if (VK_KEYDOWN(GLFW_KEY_W))
     {
         state.cam.x += forward[0] * cam_speed;
         state.cam.z += forward[2] * cam_speed;
     }
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_S) == GLFW_PRESS)
+    if (VK_KEYDOWN(GLFW_KEY_S))
     {
         state.cam.x -= forward[0] * cam_speed;
         state.cam.z -= forward[2] * cam_speed;
     }
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_D) == GLFW_PRESS)
+    if (VK_KEYDOWN(GLFW_KEY_D))
     {
         state.cam.x += right[0] * cam_speed;
         state.cam.z += right[2] * cam_speed;
     }
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_A) == GLFW_PRESS)
+    if (VK_KEYDOWN(GLFW_KEY_A))
     {
         state.cam.x -= right[0] * cam_speed;
         state.cam.z -= right[2] * cam_speed;
     }
 
     static bool b_pressed = false;
-    if (glfwGetKey(state.glfw.win, GLFW_KEY_B) == GLFW_PRESS)
+    if (VK_KEYDOWN(GLFW_KEY_B))
     {
         if (!b_pressed)
         {
@@ -0,0 +1,214 @@
+#include "Engine/App.h"
+#include "Engine/util.h"
+#include "Engine/ext/stb_image.h"
+
+#include <math.h>
+
+// Bakes loose resources into one pack for --pack
+//
+//   respack [-o FILE] FILES...
+//
+// PNGs are decoded to RGBA8 sRGB with their full mip chain, so the engine only has to copy them into
+// staging. Everything else (levels, SPIR-V) is stored as is. Each file is found again by the exact path
+// it was given here, so run it from the directory the game runs from.
+
+typedef struct
+{
+    pack_entry_t entry;
+    uint8_t *data;
+} packed_file_t;
+
+static float srgb_to_linear(const uint8_t value)
+{
+    const float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linear_to_srgb(const float value)
+{
+    const float c = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    return (uint8_t) (c <= 0.0f ? 0 : c >= 1.0f ? 255 : c * 255.0f + 0.5f);
+}
+
+// 2x2 box filter in linear space, edge texels repeat when a side is odd or already 1, matching the blits
+static void downsample(const uint8_t *src, const uint32_t src_w, const uint32_t src_h, uint8_t *dst, const uint32_t dst_w, const uint32_t dst_h)
+{
+    for (uint32_t y = 0; y < dst_h; y++)
+    {
+        const uint32_t y0 = y * 2 < src_h ? y * 2 : src_h - 1;
+        const uint32_t y1 = y * 2 + 1 < src_h ? y * 2 + 1 : y0;
+        for (uint32_t x = 0; x < dst_w; x++)
+        {
+            const uint32_t x0 = x * 2 < src_w ? x * 2 : src_w - 1;
+            const uint32_t x1 = x * 2 + 1 < src_w ? x * 2 + 1 : x0;
+            const uint8_t *texels[4] = {
+                &src[(y0 * src_w + x0) * 4], &src[(y0 * src_w + x1) * 4],
+                &src[(y1 * src_w + x0) * 4], &src[(y1 * src_w + x1) * 4]
+            };
+
+            uint8_t *out = &dst[(y * dst_w + x) * 4];
+            for (int c = 0; c < 3; c++)
+            {
+                float sum = 0.0f;
+                for (int i = 0; i < 4; i++) sum += srgb_to_linear(texels[i][c]);
+                out[c] = linear_to_srgb(sum * 0.25f);
+            }
+            out[3] = (uint8_t) ((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+        }
+    }
+}
+
+static bool pack_texture(const char *path, packed_file_t *file)
+{
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(path, &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) return false;
+
+    uint32_t mip_levels = 1;
+    for (uint32_t size = width > height ? width : height; size > 1; size >>= 1) mip_levels++;
+
+    size_t total = 0;
+    for (uint32_t level = 0, w = width, h = height; level < mip_levels; level++)
+    {
+        total += (size_t) w * h * 4;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+
+    file->data = malloc(total);
+    ASSERT(file->data, "failed to allocate mip chain");
+    memcpy(file->data, pixels, (size_t) width * height * 4);
+    stbi_image_free(pixels);
+
+    uint8_t *level_data = file->data;
+    for (uint32_t level = 1, w = width, h = height; level < mip_levels; level++)
+    {
+        const uint32_t next_w = w > 1 ? w / 2 : 1;
+        const uint32_t next_h = h > 1 ? h / 2 : 1;
+        uint8_t *next = level_data + (size_t) w * h * 4;
+        downsample(level_data, w, h, next, next_w, next_h);
+        level_data = next;
+        w = next_w;
+        h = next_h;
+    }
+
+    file->entry.type = PACK_TEXTURE;
+    file->entry.format = VK_FORMAT_R8G8B8A8_SRGB;
+    file->entry.width = (uint32_t) width;
+    file->entry.height = (uint32_t) height;
+    file->entry.mip_levels = mip_levels;
+    file->entry.size = total;
+    return true;
+}
+
+static bool pack_raw(const char *path, packed_file_t *file)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in) return false;
+    fseek(in, 0, SEEK_END);
+    const long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    file->data = malloc(size > 0 ? (size_t) size : 1);
+    ASSERT(file->data, "failed to allocate file");
+    const bool ok = size >= 0 && fread(file->data, 1, (size_t) size, in) == (size_t) size;
+    fclose(in);
+
+    file->entry.type = PACK_FILE;
+    file->entry.size = (uint64_t) size;
+    return ok;
+}
+
+static bool has_suffix(const char *str, const char *suffix)
+{
+    const size_t length = strlen(str), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(str + length - suffix_length, suffix) == 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(((const packed_file_t *) a)->entry.name, ((const packed_file_t *) b)->entry.name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = RESOURCE_PACK;
+    packed_file_t *files = calloc((size_t) argc, sizeof(packed_file_t));
+    ASSERT(files, "failed to allocate file table");
+    uint32_t count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+            continue;
+        }
+
+        packed_file_t *file = &files[count];
+        if (strlen(argv[i]) >= PACK_NAME_LENGTH)
+        {
+            fprintf(stderr, "respack: %s: path longer than %d characters\n", argv[i], PACK_NAME_LENGTH - 1);
+            return 1;
+        }
+        strcpy(file->entry.name, argv[i]);
+
+        const bool ok = has_suffix(argv[i], ".png") ? pack_texture(argv[i], file) : pack_raw(argv[i], file);
+        if (!ok)
+        {
+            fprintf(stderr, "respack: could not read %s\n", argv[i]);
+            return 1;
+        }
+        count++;
+    }
+
+    if (count == 0)
+    {
+        fprintf(stderr, "usage: %s [-o FILE] FILES...\n", argv[0]);
+        return 1;
+    }
+
+    qsort(files, count, sizeof(packed_file_t), compare_names);
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (strcmp(files[i - 1].entry.name, files[i].entry.name) == 0)
+        {
+            fprintf(stderr, "respack: %s given twice\n", files[i].entry.name);
+            return 1;
+        }
+    }
+
+    uint64_t offset = sizeof(pack_header_t) + sizeof(pack_entry_t) * count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        offset = (offset + PACK_ALIGNMENT - 1) & ~(uint64_t) (PACK_ALIGNMENT - 1);
+        files[i].entry.offset = offset;
+        offset += files[i].entry.size;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    ASSERT(out, "could not create pack");
+
+    const pack_header_t header = {.magic = PACK_MAGIC, .version = PACK_VERSION, .entry_count = count};
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint32_t i = 0; i < count; i++) fwrite(&files[i].entry, sizeof(pack_entry_t), 1, out);
+
+    static const uint8_t padding[PACK_ALIGNMENT];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fwrite(padding, 1, (size_t) (files[i].entry.offset - (uint64_t) ftell(out)), out);
+        fwrite(files[i].data, 1, (size_t) files[i].entry.size, out);
+
+        if (files[i].entry.type == PACK_TEXTURE)
+            printf("%-40s %ux%u, %u mips, %llu KB\n", files[i].entry.name, files[i].entry.width, files[i].entry.height,
+                   files[i].entry.mip_levels, (unsigned long long) files[i].entry.size / 1024);
+        else
+            printf("%-40s %llu bytes\n", files[i].entry.name, (unsigned long long) files[i].entry.size);
+        free(files[i].data);
+    }
+
+    ASSERT(fclose(out) == 0, "failed to write pack");
+    printf("Wrote %u entries, %llu KB to %s\n", count, (unsigned long long) offset / 1024, out_path);
+    free(files);
+    return 0;
+}